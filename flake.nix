@@ -58,11 +58,11 @@
             echo "  hyperfine (for benchmarking)"
             echo ""
             echo "Example build commands:"
-            echo "  gcc -O3 -o printable_binary_c printable_binary.c"
-            echo "  clang -O3 -march=native -o printable_binary_c printable_binary.c"
+            echo "  make"
+            echo "  make CC=clang release"
             echo ""
             echo "Cross-compilation example:"
-            echo "  x86_64-w64-mingw32-gcc -O3 -o printable_binary.exe printable_binary.c"
+            echo "  make windows"
             echo ""
           '';
           
@@ -80,13 +80,15 @@
           
           buildInputs = [ pkgs.gcc ];
           
+          # The Makefile generates printable_binary_tables.h before compiling;
+          # kernels are picked at runtime, so no -march=native
           buildPhase = ''
-            gcc -O3 -march=native -Wall -Wextra -o printable_binary_c printable_binary.c
+            make release CC=gcc HOSTCC=gcc
           '';
           
           installPhase = ''
             mkdir -p $out/bin
-            cp printable_binary_c $out/bin/
+            cp bin/printable_binary_c $out/bin/
           '';
           
           meta = with pkgs.lib; {
@@ -0,0 +1,362 @@
+/*
+ * PrintableBinary table generator
+ * Emits every encode/decode lookup table used by printable_binary.c as
+ * static const data, so the tool starts with its tables already in .rodata
+ * instead of building them on every run.
+ *
+ * Usage: gen_tables > printable_binary_tables.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MAX_UTF8_BYTES 4
+
+// Decode trie entries: a decoded byte, or the row indexed by the next
+// continuation byte (low 6 bits); 0 is no match
+#define DECODE_BYTE 0x100
+#define DECODE_NEXT 0x200
+#define MAX_DECODE_ROWS 256
+
+// UTF-8 encoding structure (mirrors utf8_sequence_t in printable_binary.c)
+typedef struct {
+    uint8_t bytes[MAX_UTF8_BYTES];
+    uint8_t length;
+} utf8_sequence_t;
+
+static utf8_sequence_t encode_table[256];
+static uint16_t decode_root[256];
+static uint16_t decode_rows[MAX_DECODE_ROWS][64];
+static int decode_row_count;
+
+// Helper function to create UTF-8 sequence
+static utf8_sequence_t make_utf8(const char *bytes) {
+    utf8_sequence_t seq = {0};
+    seq.length = strlen(bytes);
+    memcpy(seq.bytes, bytes, seq.length);
+    return seq;
+}
+
+// Add one sequence to the decode trie. Fails if the sequence is already
+// taken, or is a prefix of another (or has one as a prefix), so the finished
+// trie maps every encode_table sequence back to exactly one byte.
+static bool decode_insert(const utf8_sequence_t *seq, uint8_t byte) {
+    uint16_t *slot = &decode_root[seq->bytes[0]];
+    for (int k = 1; k < seq->length; k++) {
+        if (*slot & DECODE_BYTE) {
+            return false;
+        }
+        if (*slot == 0) {
+            if (decode_row_count == MAX_DECODE_ROWS) {
+                return false;
+            }
+            *slot = DECODE_NEXT | decode_row_count++;
+        }
+        // Rows are indexed by continuation bytes
+        if ((seq->bytes[k] & 0xC0) != 0x80) {
+            return false;
+        }
+        slot = &decode_rows[*slot & 0xFF][seq->bytes[k] & 0x3F];
+    }
+    if (*slot != 0) {
+        return false;
+    }
+    *slot = DECODE_BYTE | byte;
+    return true;
+}
+
+// Walk the decode trie the way the decoder does; -1 if nothing matches
+static int decode_lookup(const uint8_t *bytes, int len) {
+    uint16_t entry = decode_root[bytes[0]];
+    int k = 1;
+    while (entry & DECODE_NEXT) {
+        if (k == len || (bytes[k] & 0xC0) != 0x80) {
+            return -1;
+        }
+        entry = decode_rows[entry & 0xFF][bytes[k++] & 0x3F];
+    }
+    return entry & DECODE_BYTE && k == len ? entry & 0xFF : -1;
+}
+
+// Build the encoding and decoding tables
+static void build_tables(void) {
+    // Define special UTF-8 sequences for control characters
+    const char *special_sequences[256] = {0}; // Initialize all to NULL
+    special_sequences[0] = "\xe2\x88\x85";    // ∅ (U+2205)
+    special_sequences[1] = "\xc2\xaf";        // ¯ (U+00AF)
+    special_sequences[2] = "\xc2\xab";        // « (U+00AB)
+    special_sequences[3] = "\xc2\xbb";        // » (U+00BB)
+    special_sequences[4] = "\xcf\x9f";        // ϟ (U+03DF)
+    special_sequences[5] = "\xc2\xbf";        // ¿ (U+00BF)
+    special_sequences[6] = "\xc2\xa1";        // ¡ (U+00A1)
+    special_sequences[7] = "\xc2\xaa";        // ª (U+00AA)
+    special_sequences[8] = "\xe2\x8c\xab";    // ⌫ (U+232B)
+    special_sequences[9] = "\xe2\x87\xa5";    // ⇥ (U+21E5)
+    special_sequences[10] = "\xe2\x87\xa9";   // ⇩ (U+21E9)
+    special_sequences[11] = "\xe2\x8a\xa7";   // ↧ (U+21A7)
+    special_sequences[12] = "\xc2\xa7";       // § (U+00A7)
+    special_sequences[13] = "\xe2\x8f\x8e";   // ⏎ (U+23CE)
+    special_sequences[14] = "\xc8\xaf";       // ȯ (U+022F)
+    special_sequences[15] = "\xca\x98";       // ʘ (U+0298)
+    special_sequences[16] = "\xc6\x94";       // Ɣ (U+0194)
+    special_sequences[17] = "\xc2\xb9";       // ¹ (U+00B9)
+    special_sequences[18] = "\xc2\xb2";       // ² (U+00B2)
+    special_sequences[19] = "\xc2\xba";       // º (U+00BA)
+    special_sequences[20] = "\xc2\xb3";       // ³ (U+00B3)
+    special_sequences[21] = "\xc2\xb5";       // µ (U+00B5)
+    special_sequences[22] = "\xc9\xa8";       // ɨ (U+0268)
+    special_sequences[23] = "\xc2\xac";       // ¬ (U+00AC)
+    special_sequences[24] = "\xc2\xa9";       // © (U+00A9)
+    special_sequences[25] = "\xc2\xa6";       // ¦ (U+00A6)
+    special_sequences[26] = "\xc6\xb5";       // Ƶ (U+01B5)
+    special_sequences[27] = "\xe2\x8e\x8b";   // ⎋ (U+238B)
+    special_sequences[28] = "\xce\x9e";       // Ξ (U+039E)
+    special_sequences[29] = "\xc7\x81";       // ǁ (U+01C1)
+    special_sequences[30] = "\xc7\x80";       // ǀ (U+01C0)
+    special_sequences[31] = "\xc2\xb6";       // ¶ (U+00B6)
+    special_sequences[32] = "\xe2\x90\xa3";   // ␣ (U+2423)
+    special_sequences[33] = "\xef\xb9\x97";   // ﹗ (U+FE57) Small Exclamation Mark
+    special_sequences[34] = "\xcb\xb5";       // ˵ (U+02F5)
+    special_sequences[35] = "\xe2\x99\xaf";   // ♯ (U+266F) Music Sharp Sign
+    special_sequences[36] = "\xef\xb9\xa9";   // ﹩ (U+FE69) Small Dollar Sign
+    special_sequences[37] = "\xef\xb9\xaa";   // ﹪ (U+FE6A) Small Percent Sign
+    special_sequences[38] = "\xef\xb9\xa0";   // ﹠ (U+FE60) Small Ampersand
+    special_sequences[39] = "\xca\xbc";       // ʼ (U+02BC)
+    special_sequences[40] = "\xe2\x9d\xa8";   // ❨ (U+2768) Medium Left Parenthesis Ornament
+    special_sequences[41] = "\xe2\x9d\xa9";   // ❩ (U+2769) Medium Right Parenthesis Ornament
+    special_sequences[42] = "\xef\xb9\xa1";   // ﹡ (U+FE61) Small Asterisk
+    special_sequences[43] = "\xef\xb9\xa2";   // ﹢ (U+FE62) Small Plus Sign
+    special_sequences[45] = "\xef\xb9\xa3";   // ﹣ (U+FE63) Small Hyphen-Minus
+    special_sequences[47] = "\xe2\x81\x84";   // ⁄ (U+2044) Fraction Slash
+    special_sequences[58] = "\xef\xb9\x95";   // ﹕ (U+FE55) Small Colon
+    special_sequences[59] = "\xef\xb9\x94";   // ﹔ (U+FE54) Small Semicolon
+    special_sequences[61] = "\xef\xb9\xa6";   // ﹦ (U+FE66) Small Equals Sign
+    special_sequences[63] = "\xef\xb9\x96";   // ﹖ (U+FE56) Small Question Mark
+    special_sequences[64] = "\xef\xb9\xab";   // ﹫ (U+FE6B) Small Commercial At
+    special_sequences[91] = "\xe2\x9f\xa6";   // ⟦ (U+27E6) Mathematical Left White Square Bracket
+    special_sequences[92] = "\xe2\xa7\xb9";   // ⧹ (U+29F9) Big Reverse Solidus
+    special_sequences[93] = "\xe2\x9f\xa7";   // ⟧ (U+27E7) Mathematical Right White Square Bracket
+    special_sequences[96] = "\xcb\x8b";       // ˋ (U+02CB) Modifier Letter Grave Accent
+    special_sequences[123] = "\xe2\x9d\xb4";  // ❴ (U+2774) Medium Left Curly Bracket Ornament
+    special_sequences[124] = "\xe2\x88\xa3";  // ∣ (U+2223) Divides
+    special_sequences[125] = "\xe2\x9d\xb5";  // ❵ (U+2775) Medium Right Curly Bracket Ornament
+    special_sequences[126] = "\xcb\x9c";      // ˜ (U+02DC) Small Tilde
+    special_sequences[127] = "\xe2\x8c\xa6";  // ⌦ (U+2326)
+    special_sequences[152] = "\xc5\x8c";      // Ō (U+014C)
+    special_sequences[184] = "\xc5\x8f";      // ŏ (U+014F)
+
+    // Build encoding table
+    for (int i = 0; i < 256; i++) {
+        if (special_sequences[i]) {
+            encode_table[i] = make_utf8(special_sequences[i]);
+        } else if (i >= 33 && i <= 126) {
+            // Regular ASCII characters
+            char temp[2] = {(char)i, 0};
+            encode_table[i] = make_utf8(temp);
+        } else if (i >= 128 && i < 192) {
+            // Extended ASCII 128-191: encoded with 0xC3 + original byte
+            char temp[3] = {(char)0xc3, (char)i, 0};
+            encode_table[i] = make_utf8(temp);
+        } else if (i >= 192) {
+            // Extended ASCII 192-255: encoded with 0xC4 + (byte - 192 + 128)
+            char temp[3] = {(char)0xc4, (char)(i - 192 + 128), 0};
+            encode_table[i] = make_utf8(temp);
+        }
+    }
+
+    // Build decode trie
+    for (int i = 0; i < 256; i++) {
+        if (encode_table[i].length == 0 || !decode_insert(&encode_table[i], i)) {
+            fprintf(stderr, "gen_tables: sequence for byte %d collides in the decode trie\n", i);
+            exit(1);
+        }
+    }
+    for (int i = 0; i < 256; i++) {
+        if (decode_lookup(encode_table[i].bytes, encode_table[i].length) != i) {
+            fprintf(stderr, "gen_tables: sequence for byte %d does not decode back\n", i);
+            exit(1);
+        }
+    }
+}
+
+static void emit_bytes(const char *type, const char *name, const uint8_t *data, size_t len) {
+    printf("static const %s %s[%zu] = {", type, name, len);
+    for (size_t i = 0; i < len; i++) {
+        printf("%s0x%02x,", i % 16 == 0 ? "\n    " : " ", data[i]);
+    }
+    printf("\n};\n\n");
+}
+
+int main(void) {
+    build_tables();
+
+    printf("/* Generated by gen_tables.c - do not edit */\n\n");
+
+    printf("// Byte -> UTF-8 sequence\n");
+    printf("static const utf8_sequence_t encode_table[256] = {\n");
+    for (int i = 0; i < 256; i++) {
+        const utf8_sequence_t *seq = &encode_table[i];
+        printf("    {{0x%02x, 0x%02x, 0x%02x, 0x%02x}, %u},  // %d\n",
+               seq->bytes[0], seq->bytes[1], seq->bytes[2], seq->bytes[3], seq->length, i);
+    }
+    printf("};\n\n");
+
+    printf("// Decode trie, one level per byte of a sequence: decode_root is indexed by\n");
+    printf("// the first byte, each decode_rows row by the low 6 bits of the next\n");
+    printf("// continuation byte. An entry is DECODE_BYTE | byte for a complete sequence,\n");
+    printf("// DECODE_NEXT | row to continue, or 0 for no match.\n");
+    printf("#define DECODE_BYTE 0x%x\n", DECODE_BYTE);
+    printf("#define DECODE_NEXT 0x%x\n", DECODE_NEXT);
+    printf("static const uint16_t decode_root[256] = {");
+    for (int i = 0; i < 256; i++) {
+        printf("%s0x%03x,", i % 12 == 0 ? "\n    " : " ", decode_root[i]);
+    }
+    printf("\n};\n\n");
+    printf("static const uint16_t decode_rows[%d][64] = {\n", decode_row_count);
+    for (int r = 0; r < decode_row_count; r++) {
+        printf("    {");
+        for (int c = 0; c < 64; c++) {
+            printf("%s0x%03x,", c % 12 == 0 ? "\n        " : " ", decode_rows[r][c]);
+        }
+        printf("\n    },\n");
+    }
+    printf("};\n\n");
+
+    // Packed encode table for vector kernels
+    printf("// Packed encode table for vector kernels: bytes in the low 3 bytes, length in the top byte\n");
+    printf("static const uint32_t encode_packed[256] = {");
+    for (int i = 0; i < 256; i++) {
+        const utf8_sequence_t *seq = &encode_table[i];
+        uint32_t packed = (uint32_t)seq->bytes[0] | ((uint32_t)seq->bytes[1] << 8) |
+                          ((uint32_t)seq->bytes[2] << 16) | ((uint32_t)seq->length << 24);
+        printf("%s0x%08x,", i % 8 == 0 ? "\n    " : " ", packed);
+    }
+    printf("\n};\n\n");
+
+    // Nibble bitmaps
+    uint8_t passthrough_lo_bits[16] = {0};
+    uint8_t passthrough_hi_bits[16] = {0};
+    uint8_t length3_lo_bits[16] = {0};
+    uint8_t encode_length[256];
+    for (int i = 0; i < 256; i++) {
+        encode_length[i] = encode_table[i].length;
+        if (encode_table[i].length == 1) {
+            passthrough_lo_bits[i & 0x0F] |= 1 << (i >> 4);
+        } else if (encode_table[i].length == 3) {
+            if (i >= 128) {
+                fprintf(stderr, "gen_tables: byte %d has a 3-byte sequence; length3_lo_bits assumes bytes below 0x80\n", i);
+                return 1;
+            }
+            length3_lo_bits[i & 0x0F] |= 1 << (i >> 4);
+        }
+    }
+    for (int h = 0; h < 8; h++) {
+        passthrough_hi_bits[h] = 1 << h;
+    }
+    printf("// Nibble bitmaps classifying passthrough ASCII (bytes that encode to themselves):\n");
+    printf("// byte b is passthrough iff passthrough_lo_bits[b & 0xF] & passthrough_hi_bits[b >> 4]\n");
+    emit_bytes("uint8_t", "passthrough_lo_bits", passthrough_lo_bits, 16);
+    emit_bytes("uint8_t", "passthrough_hi_bits", passthrough_hi_bits, 16);
+    printf("// Same layout for bytes whose sequence is 3 bytes long (all below 0x80)\n");
+    emit_bytes("uint8_t", "length3_lo_bits", length3_lo_bits, 16);
+    printf("// Encoded length of every byte, for sizing output before encoding\n");
+    emit_bytes("uint8_t", "encode_length", encode_length, 256);
+
+    // Shuffle masks compacting four packed dwords
+    printf("// Shuffle masks that compact four packed dwords into their UTF-8 bytes.\n");
+    printf("// Index: bit k = dword k has length >= 2, bit k+4 = dword k has length 3\n");
+    uint8_t shuffle_len[256];
+    printf("static const uint8_t encode_shuffle[256][16] = {\n");
+    for (int mask = 0; mask < 256; mask++) {
+        uint8_t shuffle[16];
+        uint8_t out = 0;
+        memset(shuffle, 0x80, sizeof(shuffle));
+        for (int k = 0; k < 4; k++) {
+            int len = 1 + ((mask >> k) & 1) + ((mask >> (k + 4)) & 1);
+            for (int j = 0; j < len; j++) {
+                shuffle[out++] = 4 * k + j;
+            }
+        }
+        shuffle_len[mask] = out;
+        printf("    {");
+        for (int j = 0; j < 16; j++) {
+            printf("0x%02x%s", shuffle[j], j < 15 ? ", " : "");
+        }
+        printf("},\n");
+    }
+    printf("};\n\n");
+    emit_bytes("uint8_t", "encode_shuffle_len", shuffle_len, 256);
+
+    // Byte planes
+    printf("// Byte planes of encode_table for in-register lookups: plane j holds byte j of\n");
+    printf("// every sequence (0 where the sequence is shorter)\n");
+    printf("static const uint8_t encode_planes[3][256] = {\n");
+    for (int j = 0; j < 3; j++) {
+        printf("    {");
+        for (int i = 0; i < 256; i++) {
+            printf("%s0x%02x,", i % 16 == 0 ? "\n        " : " ", encode_table[i].bytes[j]);
+        }
+        printf("\n    },\n");
+    }
+    printf("};\n\n");
+
+    // Interleave permutes
+    uint64_t j0[3] = {0}, j2[3] = {0};
+    printf("// Permute indices interleaving the three planes of 64 input bytes into 192\n");
+    printf("// output positions (3 per input byte), plus masks of the positions taken from\n");
+    printf("// plane 0 and plane 2 in each 64-byte third\n");
+    printf("static const uint8_t encode_interleave[3][64] = {\n");
+    for (int k = 0; k < 3; k++) {
+        printf("    {");
+        for (int p = 0; p < 64; p++) {
+            int g = 64 * k + p;
+            printf("%s0x%02x,", p % 16 == 0 ? "\n        " : " ", (g / 3) | (g % 3 == 1 ? 64 : 0));
+            if (g % 3 == 0) j0[k] |= 1ULL << p;
+            if (g % 3 == 2) j2[k] |= 1ULL << p;
+        }
+        printf("\n    },\n");
+    }
+    printf("};\n\n");
+    printf("static const uint64_t encode_interleave_j0[3] = {0x%016llxULL, 0x%016llxULL, 0x%016llxULL};\n",
+           (unsigned long long)j0[0], (unsigned long long)j0[1], (unsigned long long)j0[2]);
+    printf("static const uint64_t encode_interleave_j2[3] = {0x%016llxULL, 0x%016llxULL, 0x%016llxULL};\n",
+           (unsigned long long)j2[0], (unsigned long long)j2[1], (unsigned long long)j2[2]);
+    printf("\n");
+
+    // Decode compaction shuffles
+    printf("// Shuffle indices that pack the bytes selected by an 8-bit mask to the front\n");
+    printf("// of an 8-byte group (0x80 zeroes the unused positions)\n");
+    printf("static const uint8_t decode_compress[256][8] = {\n");
+    for (int mask = 0; mask < 256; mask++) {
+        uint8_t shuffle[8];
+        int out = 0;
+        memset(shuffle, 0x80, sizeof(shuffle));
+        for (int k = 0; k < 8; k++) {
+            if (mask & (1 << k)) {
+                shuffle[out++] = k;
+            }
+        }
+        printf("    {");
+        for (int j = 0; j < 8; j++) {
+            printf("0x%02x%s", shuffle[j], j < 7 ? ", " : "");
+        }
+        printf("},\n");
+    }
+    printf("};\n");
+
+    // The vector decoders turn C3 xx and C4 xx pairs into bytes arithmetically
+    for (int b = 0x80; b < 0xC0; b++) {
+        int c3 = decode_lookup((const uint8_t[]){0xC3, b}, 2);
+        int c4 = decode_lookup((const uint8_t[]){0xC4, b}, 2);
+        int c3_expected = b != 0x98 && b != 0xB8 ? b : -1;
+        if (c3 != c3_expected || c4 != b + 64) {
+            fprintf(stderr, "gen_tables: C3/C4 pairs no longer decode arithmetically (continuation 0x%02x)\n", b);
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -4,6 +4,9 @@
  * Encodes binary data into human-readable UTF-8 and decodes it back
  */
 
+// madvise, tee, splice and friends alongside -std=c99
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,12 +16,71 @@
 #include <getopt.h>
 #include <sys/stat.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <limits.h>
+#include <time.h>
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <poll.h>
+#define PB_MMAP 1
+#else
+#define PB_MMAP 0
+#endif
+// Zero-copy passthrough with tee(2) and splice(2)
+#if defined(__linux__)
+#define PB_SPLICE 1
+#else
+#define PB_SPLICE 0
+#endif
+// Optional io_uring I/O, through raw syscalls (no liburing)
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#define PB_IO_URING 1
+#endif
+#endif
+#ifndef PB_IO_URING
+#define PB_IO_URING 0
+#endif
+
+// Vector kernels are compiled per instruction set and picked at runtime
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define PB_X86_KERNELS 1
+#include <immintrin.h>
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2,popcnt")))
+#define TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx512vbmi,avx512vbmi2,popcnt")))
+#else
+#define PB_X86_KERNELS 0
+#endif
+
+#if defined(__GNUC__)
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#define COLD __attribute__((noinline, cold))
+#else
+#define ALWAYS_INLINE inline
+#define COLD
+#endif
 
 #define MAX_UTF8_BYTES 4
-#define DECODE_MAP_SIZE 65536  // Covers all possible 2-byte combinations
 #define INITIAL_BUFFER_SIZE 8192
 #define BUFFER_GROW_FACTOR 2
 #define STACK_BUFFER_SIZE 4096
+#define DECODE_CHUNK_SIZE 65536  // Input bytes decoded per output reservation
+#define ENCODE_MAX_EXPANSION 3   // Longest encode_table sequence
+#define ENCODE_SLACK 64          // Vector kernels may store past the logical end
+#define DECODE_IN_PLACE_GAP ENCODE_SLACK  // Lead of input over output in decode_in_place
+#define PARALLEL_CHUNK_SIZE (256 * 1024)  // Input bytes per parallel task, sized for L2
+#define STREAM_BLOCK_SIZE (1024 * 1024)   // Input bytes read and encoded at a time
+#define MONITOR_FLUSH_BYTES 4096  // Default --monitor flush thresholds
+#define MONITOR_FLUSH_MS 50
+#define URING_DEPTH 4            // io_uring reads, and writes, in flight
+#define URING_CARRY_ROOM 4096    // Room before each io_uring read for a decode carry
 
 // UTF-8 encoding structure
 typedef struct {
@@ -26,10 +88,13 @@ typedef struct {
     uint8_t length;
 } utf8_sequence_t;
 
-// Global encoding and decoding tables
-static utf8_sequence_t *encode_table;
-static uint8_t *decode_table;
-static bool *decode_table_valid;
+// Encoding and decoding tables, generated at build time by gen_tables.c:
+//   encode_table        byte -> UTF-8 sequence
+//   decode_root/rows    decode trie, UTF-8 sequence -> byte
+//   encode_packed, encode_length, passthrough/length3 nibble bitmaps,
+//   encode_shuffle(_len), encode_planes, encode_interleave(_j0/_j2),
+//   decode_compress     derived tables for the vector kernels
+#include "printable_binary_tables.h"
 
 // Program options
 typedef struct {
@@ -39,9 +104,19 @@ typedef struct {
     bool asm_mode;
     bool smart_asm_mode;
     bool help_mode;
+    bool print_kernel;
+    bool encoded_size_mode;
+    bool strict_mode;
+    bool report_mode;
+    bool io_uring;
+    bool monitor_mode;
+    size_t monitor_bytes;
+    int monitor_ms;
     int format_group;
     int format_groups_per_line;
+    int jobs;
     char *arch;
+    char *kernel_name;
     char *input_file;
 } options_t;
 
@@ -95,298 +170,2580 @@ static void buffer_grow(buffer_t *buf, size_t min_additional) {
             fprintf(stderr, "Memory allocation failed\n");
             exit(1);
         }
-        // Copy existing data from stack buffer
-        memcpy(new_data, buf->stack_data, buf->size);
-        buf->uses_stack = false;
-    } else {
-        // Regular heap reallocation
-        new_data = realloc(buf->data, new_capacity);
-        if (!new_data) {
-            fprintf(stderr, "Memory reallocation failed\n");
-            exit(1);
+        // Copy existing data from stack buffer
+        memcpy(new_data, buf->stack_data, buf->size);
+        buf->uses_stack = false;
+    } else {
+        // Regular heap reallocation
+        new_data = realloc(buf->data, new_capacity);
+        if (!new_data) {
+            fprintf(stderr, "Memory reallocation failed\n");
+            exit(1);
+        }
+    }
+
+    buf->data = new_data;
+    buf->capacity = new_capacity;
+}
+
+// Make room for at least len more bytes
+static void buffer_reserve(buffer_t *buf, size_t len) {
+    if (buf->size + len > buf->capacity) {
+        buffer_grow(buf, len);
+    }
+}
+
+// Append data to buffer with automatic growth
+static void buffer_append(buffer_t *buf, const void *data, size_t len) {
+    if (buf->size + len > buf->capacity) {
+        buffer_grow(buf, len);
+    }
+
+    memcpy(buf->data + buf->size, data, len);
+    buf->size += len;
+}
+
+// Prepare buffer for return - ensure data is heap-allocated
+static void buffer_prepare_return(buffer_t *buf) {
+    if (buf->uses_stack) {
+        // Need to transition from stack to heap before returning
+        // (callers free the result, so even an empty buffer gets a heap block)
+        char *heap_data = malloc(buf->size > 0 ? buf->size : 1);
+        if (!heap_data) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+        memcpy(heap_data, buf->stack_data, buf->size);
+        buf->data = heap_data;
+        buf->capacity = buf->size;
+        buf->uses_stack = false;
+    }
+}
+
+// Free buffer memory
+static void buffer_free(buffer_t *buf) {
+    if (buf->data && !buf->uses_stack) {
+        free(buf->data);
+    }
+    // Don't set data to NULL for stack buffers since it points to stack_data
+    if (!buf->uses_stack) {
+        buf->data = NULL;
+    }
+    buf->size = 0;
+    buf->capacity = 0;
+}
+
+#define SWAR_ONES 0x0101010101010101ULL
+#define SWAR_HIGH 0x8080808080808080ULL
+
+// Sets bit 7 of every byte of w that lies in [lo, hi]; bytes must be below 0x80
+static inline uint64_t swar_in_range(uint64_t w, uint8_t lo, uint8_t hi) {
+    uint64_t ge_lo = w + SWAR_ONES * (0x80 - lo);
+    uint64_t gt_hi = w + SWAR_ONES * (0x7F - hi);
+    return ge_lo & ~gt_hi & SWAR_HIGH;
+}
+
+// Sets bit 7 of every passthrough ASCII byte of w (bytes must be below 0x80):
+// , . 0-9 < > A-Z ^ _ a-z, i.e. 33-126 minus the special_sequences overrides.
+// Folding bit 5 maps A-Z onto a-z, folding bit 1 maps ',' and '<' onto '.' and '>'.
+static inline uint64_t swar_passthrough(uint64_t w) {
+    uint64_t fold_case = w | (SWAR_ONES * 0x20);
+    uint64_t fold_bit1 = w | (SWAR_ONES * 0x02);
+    return swar_in_range(w, '0', '9') | swar_in_range(fold_case, 'a', 'z') |
+           swar_in_range(w, '^', '_') | swar_in_range(fold_bit1, '.', '.') |
+           swar_in_range(fold_bit1, '>', '>');
+}
+
+#ifdef DEBUG
+// The SWAR encoder hardcodes the passthrough ranges; keep them in sync
+static void check_tables(void) {
+    for (int i = 0; i < 128; i++) {
+        bool swar = swar_passthrough(SWAR_ONES * i) == SWAR_HIGH;
+        if (swar != (encode_table[i].length == 1)) {
+            fprintf(stderr, "SWAR passthrough ranges disagree with encode_table at byte %d\n", i);
+            abort();
+        }
+    }
+}
+#endif
+
+// Store one encode_packed entry: all four bytes are written unconditionally
+// and the caller advances by the length in the top byte, so every byte costs
+// one load and one store with no branch on the sequence length.
+static inline uint8_t *store_packed(uint8_t *out, uint32_t packed) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    uint32_t bytes = __builtin_bswap32(packed);
+#else
+    uint32_t bytes = packed;
+#endif
+    memcpy(out, &bytes, 4);
+    return out + (packed >> 24);
+}
+
+// Scalar encode kernel. Words of 8 passthrough ASCII bytes are copied whole;
+// any word holding a special, control or high byte falls back to one packed
+// table store per byte.
+// Writes at most ENCODE_MAX_EXPANSION * len bytes to out, returns bytes written.
+// Needs ENCODE_SLACK bytes of room past the worst-case output.
+static size_t encode_scalar(const uint8_t *input, size_t len, uint8_t *out) {
+    uint8_t *start = out;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, input + i, 8);
+        if ((w & SWAR_HIGH) == 0 && swar_passthrough(w) == SWAR_HIGH) {
+            memcpy(out, &w, 8);
+            out += 8;
+            continue;
+        }
+        for (size_t k = 0; k < 8; k++) {
+            out = store_packed(out, encode_packed[input[i + k]]);
+        }
+    }
+    for (; i < len; i++) {
+        out = store_packed(out, encode_packed[input[i]]);
+    }
+    return out - start;
+}
+
+// Exact encoded size of input, summed from encode_length with independent
+// accumulators so the loads overlap
+static size_t encoded_size_scalar(const uint8_t *input, size_t len) {
+    size_t sum[4] = {0, 0, 0, 0};
+    size_t i = 0;
+    for (; i + 4 <= len; i += 4) {
+        sum[0] += encode_length[input[i]];
+        sum[1] += encode_length[input[i + 1]];
+        sum[2] += encode_length[input[i + 2]];
+        sum[3] += encode_length[input[i + 3]];
+    }
+    for (; i < len; i++) {
+        sum[0] += encode_length[input[i]];
+    }
+    return sum[0] + sum[1] + sum[2] + sum[3];
+}
+
+// Whitespace is ignored anywhere in decode input, even inside a character.
+// Bitwise ors keep counting loops over this branch-free so they vectorize.
+static inline bool is_decode_whitespace(uint8_t c) {
+    return (c == ' ') | (c == '\t') | (c == '\n') | (c == '\r');
+}
+
+// Disassembly listings (-a, --smart-asm) annotate the encoded bytes: the
+// receipt emoji starts a line's instruction text and '#' a header line.
+// Neither can begin an encoded character, so decoding skips everything from
+// either through to the end of its line.
+static const uint8_t decode_receipt[4] = {0xF0, 0x9F, 0xA7, 0xBE};
+
+static inline bool is_annotation_start(const uint8_t *input, size_t input_len, size_t i) {
+    return input[i] == '#' ||
+           (input[i] == decode_receipt[0] && input_len - i >= sizeof(decode_receipt) &&
+            memcmp(input + i, decode_receipt, sizeof(decode_receipt)) == 0);
+}
+
+// End of the line input[i] is on: its newline, or input_len
+static size_t line_end(const uint8_t *input, size_t input_len, size_t i) {
+    const uint8_t *newline = memchr(input + i, '\n', input_len - i);
+    return newline ? (size_t)(newline - input) : input_len;
+}
+
+// First annotation start in input[from, to), or to if there is none
+static size_t first_annotation(const uint8_t *input, size_t from, size_t to) {
+    const uint8_t *hash = memchr(input + from, '#', to - from);
+    if (hash) {
+        to = hash - input;
+    }
+    const uint8_t *lead = input + from;
+    while ((lead = memchr(lead, decode_receipt[0], to - (lead - input))) != NULL) {
+        if (is_annotation_start(input, to, lead - input)) {
+            return lead - input;
+        }
+        lead++;
+    }
+    return to;
+}
+
+// Start of the annotation still open at pos, or pos if there is none. No
+// annotation may be open at from. Input without annotations costs two
+// memchr scans; otherwise the scan back for the line start stops at the
+// first annotation.
+static size_t open_annotation(const uint8_t *input, size_t from, size_t pos) {
+    size_t first = first_annotation(input, from, pos);
+    size_t line = pos;
+    while (line > first && input[line - 1] != '\n') {
+        line--;
+    }
+    return line > first ? first_annotation(input, line, pos) : first;
+}
+
+// A decode's search for annotations as it moves forward through its input:
+// the next '#' and receipt lead byte found, or where a search for one ended
+// without finding it. Each search carries on from there, so input with an
+// annotation on every line is still scanned only once.
+typedef struct {
+    size_t hash;
+    size_t lead;
+} annotation_scan_t;
+
+// Next c in input[pos, end), or end if there is none
+static size_t scan_byte(const uint8_t *input, size_t pos, size_t end, uint8_t c, size_t *next) {
+    if (*next < pos || (*next < end && input[*next] != c)) {
+        size_t from = *next < pos ? pos : *next;
+        const uint8_t *found = memchr(input + from, c, end - from);
+        *next = found ? (size_t)(found - input) : end;
+    }
+    return *next < end ? *next : end;
+}
+
+// First annotation start in input[pos, end), or end if there is none
+static size_t next_annotation(const uint8_t *input, size_t pos, size_t end, annotation_scan_t *scan) {
+    end = scan_byte(input, pos, end, '#', &scan->hash);
+    for (;;) {
+        size_t lead = scan_byte(input, pos, end, decode_receipt[0], &scan->lead);
+        if (lead == end || is_annotation_start(input, end, lead)) {
+            return lead;
+        }
+        pos = lead + 1;
+    }
+}
+
+// Decode the one character at input[i], ignoring whitespace: walk the decode
+// trie one continuation byte per level, and skip the byte if the walk doesn't
+// end on a complete sequence. Every decode kernel falls back to this for
+// anything its fast paths don't cover, so they all agree on invalid input.
+// Returns input bytes consumed.
+static ALWAYS_INLINE size_t decode_char(const uint8_t *input, size_t input_len, size_t i, uint8_t **out) {
+    uint16_t entry = decode_root[input[i]];
+    size_t j = i + 1;
+    while (entry & DECODE_NEXT) {
+        if (j == input_len) {
+            return 1;
+        }
+        uint8_t c = input[j++];
+        if ((c & 0xC0) == 0x80) {
+            entry = decode_rows[entry & 0xFF][c & 0x3F];
+        } else if (!is_decode_whitespace(c)) {
+            // Skip unrecognized byte
+            return 1;
+        }
+    }
+    if (entry & DECODE_BYTE) {
+        *(*out)++ = (uint8_t)entry;
+        return j - i;
+    }
+
+    // Skip unrecognized byte (whitespace included)
+    return 1;
+}
+
+// Scalar decode kernel. Words of 8 passthrough ASCII bytes decode to
+// themselves and are copied whole; everything else, whitespace included,
+// goes through decode_char. Taking the character length from the lead byte
+// and reading the trie levels branch-free measured slower than this walk on
+// text, binary and mixed input alike, so the walk stays.
+// Writes at most len bytes to out, returns bytes written.
+static size_t decode_scalar(const uint8_t *input, size_t len, uint8_t *out) {
+    uint8_t *start = out;
+    size_t i = 0;
+    while (i + 8 <= len) {
+        uint64_t w;
+        memcpy(&w, input + i, 8);
+        if ((w & SWAR_HIGH) == 0 && swar_passthrough(w) == SWAR_HIGH) {
+            memcpy(out, &w, 8);
+            out += 8;
+            i += 8;
+            continue;
+        }
+        i += decode_char(input, len, i, &out);
+    }
+    while (i < len) {
+        i += decode_char(input, len, i, &out);
+    }
+    return out - start;
+}
+
+// Lead and continuation bytes of some decode input; whitespace is neither.
+// Every decoded byte starts at a lead, so leads bounds the decoded size
+// (exactly, for valid input).
+typedef struct {
+    size_t leads;
+    size_t continuations;
+} decode_counts_t;
+
+// Scalar counting kernel: SWAR over 8-byte words
+static decode_counts_t count_decode_scalar(const uint8_t *input, size_t len) {
+    size_t whitespace = 0, continuations = 0;
+    size_t i = 0;
+    while (i + 8 <= len) {
+        // One count per byte lane, summed across lanes every 31 words
+        // so a lane total can't pass 8 * 31 and overflow the multiply fold
+        uint64_t space_lanes = 0, continuation_lanes = 0;
+        for (int n = 0; n < 31 && i + 8 <= len; n++, i += 8) {
+            uint64_t w;
+            memcpy(&w, input + i, 8);
+            uint64_t low = w & ~SWAR_HIGH;
+            uint64_t space = (swar_in_range(low, '\t', '\n') | swar_in_range(low, '\r', '\r') |
+                              swar_in_range(low, ' ', ' ')) & ~w;
+            space_lanes += space >> 7;
+            continuation_lanes += (w & ~(w << 1) & SWAR_HIGH) >> 7;
+        }
+        whitespace += (space_lanes * SWAR_ONES) >> 56;
+        continuations += (continuation_lanes * SWAR_ONES) >> 56;
+    }
+    for (; i < len; i++) {
+        whitespace += is_decode_whitespace(input[i]);
+        continuations += (input[i] & 0xC0) == 0x80;
+    }
+    return (decode_counts_t){len - whitespace - continuations, continuations};
+}
+
+// The vector decode kernels classify each byte of a block as passthrough
+// ASCII (decodes to itself), a C3/C4 lead (C3 xx decodes to xx, C4 xx to
+// xx + 64), a continuation, whitespace (dropped), or anything else. The block
+// is decoded in registers up to the first byte that breaks that pattern: a
+// byte of another class, a continuation without a C3/C4 lead right before
+// it, a lead not directly followed by a continuation (including whitespace
+// in between), or C3 98 / C3 B8 (not valid encodings; 152 and 184 use C5).
+// A lead in the last position is left for the next block. decode_char then
+// handles the character that stopped the block.
+//
+// Returns the number of leading bytes of the block that can be decoded in
+// registers, given per-byte masks of the classes and of 0x98/0xB8 bytes.
+static inline size_t decode_block_prefix(uint64_t passthrough, uint64_t lead_c3, uint64_t lead_c4,
+                                         uint64_t continuation, uint64_t whitespace,
+                                         uint64_t c3_excluded, size_t width) {
+    uint64_t block = width == 64 ? ~0ULL : (1ULL << width) - 1;
+    uint64_t lead = lead_c3 | lead_c4;
+    uint64_t bad = (~(passthrough | lead | continuation | whitespace) | (continuation ^ (lead << 1)) |
+                    (c3_excluded & (lead_c3 << 1))) & block;
+    size_t n = bad ? (size_t)__builtin_ctzll(bad) : width;
+    if (n > 0 && (lead >> (n - 1)) & 1) {
+        n--;
+    }
+    return n;
+}
+
+#if PB_X86_KERNELS
+// Sum of the two 64-bit lanes of a SAD total. 32-bit x86 has no 64-bit
+// lane extracts, but there size_t is 32 bits and the low halves suffice.
+TARGET_SSE41 static inline size_t sum_epi64(__m128i v) {
+#if defined(__x86_64__)
+    return (size_t)_mm_cvtsi128_si64(v) + (size_t)_mm_extract_epi64(v, 1);
+#else
+    return (size_t)_mm_cvtsi128_si32(v) + (size_t)_mm_extract_epi32(v, 2);
+#endif
+}
+
+// SSE4.1 encode kernel, 16 input bytes per iteration.
+// Same scheme as the AVX2 kernel, with the packed sequences loaded from the
+// table directly since SSE has no gather.
+TARGET_SSE41 static size_t encode_sse41(const uint8_t *input, size_t len, uint8_t *out) {
+    uint8_t *start = out;
+    const __m128i lo_bits = _mm_loadu_si128((const __m128i *)passthrough_lo_bits);
+    const __m128i hi_bits = _mm_loadu_si128((const __m128i *)passthrough_hi_bits);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i len_ge2 = _mm_set1_epi32(0x01FFFFFF);
+    const __m128i len_ge3 = _mm_set1_epi32(0x02FFFFFF);
+    size_t i = 0;
+
+    while (i + 16 <= len) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(input + i));
+        __m128i lo = _mm_and_si128(v, nibble);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+        __m128i bits = _mm_and_si128(_mm_shuffle_epi8(lo_bits, lo), _mm_shuffle_epi8(hi_bits, hi));
+        unsigned special = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(bits, _mm_setzero_si128()));
+
+        if (special == 0) {
+            _mm_storeu_si128((__m128i *)out, v);
+            out += 16;
+            i += 16;
+            continue;
+        }
+
+        unsigned run = __builtin_ctz(special);
+        if (run >= 4) {
+            _mm_storeu_si128((__m128i *)out, v);
+            out += run;
+            i += run;
+            continue;
+        }
+
+        for (int k = 0; k < 4; k++) {
+            const uint8_t *p = input + i + 4 * k;
+            __m128i seq = _mm_setr_epi32((int)encode_packed[p[0]], (int)encode_packed[p[1]],
+                                         (int)encode_packed[p[2]], (int)encode_packed[p[3]]);
+            unsigned ge2 = (unsigned)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(seq, len_ge2)));
+            unsigned ge3 = (unsigned)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(seq, len_ge3)));
+            unsigned cls = ge2 | (ge3 << 4);
+            _mm_storeu_si128((__m128i *)out,
+                             _mm_shuffle_epi8(seq, _mm_loadu_si128((const __m128i *)encode_shuffle[cls])));
+            out += encode_shuffle_len[cls];
+        }
+        i += 16;
+    }
+
+    out += encode_scalar(input + i, len - i, out);
+    return out - start;
+}
+
+// SSE4.1 size kernel: classify 16 bytes with the nibble bitmaps and count
+// each byte's extra length (0, 1 or 2) in byte lanes, widening with PSADBW
+// before the lanes can overflow
+TARGET_SSE41 static size_t encoded_size_sse41(const uint8_t *input, size_t len) {
+    const __m128i pass_lo = _mm_loadu_si128((const __m128i *)passthrough_lo_bits);
+    const __m128i len3_lo = _mm_loadu_si128((const __m128i *)length3_lo_bits);
+    const __m128i hi_bits = _mm_loadu_si128((const __m128i *)passthrough_hi_bits);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i total = zero;
+    size_t i = 0;
+
+    while (i + 16 <= len) {
+        __m128i acc = zero;
+        for (int round = 0; round < 127 && i + 16 <= len; round++, i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(input + i));
+            __m128i lo = _mm_and_si128(v, nibble);
+            __m128i hi = _mm_shuffle_epi8(hi_bits, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+            __m128i pass = _mm_cmpeq_epi8(_mm_and_si128(_mm_shuffle_epi8(pass_lo, lo), hi), zero);
+            __m128i len3 = _mm_cmpeq_epi8(_mm_and_si128(_mm_shuffle_epi8(len3_lo, lo), hi), zero);
+            // pass is -1 for non-passthrough bytes, len3 is -1 for bytes shorter than 3
+            acc = _mm_sub_epi8(acc, pass);
+            acc = _mm_add_epi8(acc, _mm_andnot_si128(len3, _mm_set1_epi8(1)));
+        }
+        total = _mm_add_epi64(total, _mm_sad_epu8(acc, zero));
+    }
+
+    size_t extra = sum_epi64(total);
+    return i + extra + encoded_size_scalar(input + i, len - i);
+}
+
+// SSE4.1 decode kernel, 16 input bytes per iteration (see decode_block_prefix).
+// The decoded bytes are packed with one PSHUFB per 8-byte group.
+// Writes at most len bytes to out, returns bytes written.
+TARGET_SSE41 static size_t decode_sse41(const uint8_t *input, size_t len, uint8_t *out) {
+    uint8_t *start = out;
+    const __m128i lo_bits = _mm_loadu_si128((const __m128i *)passthrough_lo_bits);
+    const __m128i hi_bits = _mm_loadu_si128((const __m128i *)passthrough_hi_bits);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    // One byte of lookahead for the continuation after each lead
+    while (i + 17 <= len) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(input + i));
+        __m128i lo = _mm_and_si128(v, nibble);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+        __m128i bits = _mm_and_si128(_mm_shuffle_epi8(lo_bits, lo), _mm_shuffle_epi8(hi_bits, hi));
+        __m128i not_passthrough = _mm_cmpeq_epi8(bits, zero);
+        unsigned passthrough = ~(unsigned)_mm_movemask_epi8(not_passthrough) & 0xFFFF;
+
+        if (passthrough == 0xFFFF) {
+            _mm_storeu_si128((__m128i *)out, v);
+            out += 16;
+            i += 16;
+            continue;
+        }
+
+        __m128i is_c4 = _mm_cmpeq_epi8(v, _mm_set1_epi8((char)0xC4));
+        unsigned lead_c3 = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8((char)0xC3)));
+        unsigned lead_c4 = (unsigned)_mm_movemask_epi8(is_c4);
+        // 0x80-0xBF are the signed bytes below -64
+        unsigned continuation = (unsigned)_mm_movemask_epi8(_mm_cmplt_epi8(v, _mm_set1_epi8(-64)));
+        unsigned whitespace = (unsigned)_mm_movemask_epi8(_mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))),
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\t')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')))));
+        unsigned excluded = (unsigned)_mm_movemask_epi8(_mm_or_si128(
+            _mm_cmpeq_epi8(v, _mm_set1_epi8((char)0x98)), _mm_cmpeq_epi8(v, _mm_set1_epi8((char)0xB8))));
+        size_t n = decode_block_prefix(passthrough, lead_c3, lead_c4, continuation, whitespace, excluded, 16);
+
+        if (n > 0) {
+            unsigned keep = (passthrough | lead_c3 | lead_c4) & ((1u << n) - 1);
+            __m128i next = _mm_loadu_si128((const __m128i *)(input + i + 1));
+            next = _mm_add_epi8(next, _mm_and_si128(is_c4, _mm_set1_epi8(64)));
+            __m128i decoded = _mm_blendv_epi8(v, next, not_passthrough);
+            __m128i idx = _mm_unpacklo_epi64(
+                _mm_loadl_epi64((const __m128i *)decode_compress[keep & 0xFF]),
+                _mm_add_epi8(_mm_loadl_epi64((const __m128i *)decode_compress[keep >> 8]), _mm_set1_epi8(8)));
+            __m128i packed = _mm_shuffle_epi8(decoded, idx);
+            _mm_storel_epi64((__m128i *)out, packed);
+            out += __builtin_popcount(keep & 0xFF);
+            _mm_storel_epi64((__m128i *)out, _mm_unpackhi_epi64(packed, packed));
+            out += __builtin_popcount(keep >> 8);
+            i += n;
+        }
+        if (n < 16) {
+            i += decode_char(input, len, i, &out);
+        }
+    }
+    while (i < len) {
+        i += decode_char(input, len, i, &out);
+    }
+    return out - start;
+}
+
+// SSE4.1 counting kernel: whitespace is the byte that equals its own entry
+// in a low-nibble table (bytes >= 0x80 look up 0), continuations are the
+// signed bytes below (int8_t)0xC0; both counted in byte lanes with PSADBW
+TARGET_SSE41 static decode_counts_t count_decode_sse41(const uint8_t *input, size_t len) {
+    const __m128i space_table = _mm_setr_epi8(' ', 0, 0, 0, 0, 0, 0, 0, 0, '\t', '\n', 0, 0, '\r', 0, 0);
+    const __m128i lead_min = _mm_set1_epi8((char)0xC0);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i space_total = zero, continuation_total = zero;
+    size_t i = 0;
+
+    while (i + 16 <= len) {
+        __m128i space_acc = zero, continuation_acc = zero;
+        for (int round = 0; round < 255 && i + 16 <= len; round++, i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(input + i));
+            space_acc = _mm_sub_epi8(space_acc, _mm_cmpeq_epi8(_mm_shuffle_epi8(space_table, v), v));
+            continuation_acc = _mm_sub_epi8(continuation_acc, _mm_cmplt_epi8(v, lead_min));
+        }
+        space_total = _mm_add_epi64(space_total, _mm_sad_epu8(space_acc, zero));
+        continuation_total = _mm_add_epi64(continuation_total, _mm_sad_epu8(continuation_acc, zero));
+    }
+
+    decode_counts_t tail = count_decode_scalar(input + i, len - i);
+    size_t whitespace = sum_epi64(space_total);
+    size_t continuations = sum_epi64(continuation_total);
+    return (decode_counts_t){i - whitespace - continuations + tail.leads, continuations + tail.continuations};
+}
+
+// AVX2 encode kernel, 32 input bytes per iteration.
+// Blocks of pure passthrough ASCII are copied as one vector. Anything else is
+// expanded 8 bytes at a time: gather the packed sequences, classify each into
+// the 1-, 2- or 3-byte output class and compact with a shuffle table.
+// Needs ENCODE_SLACK bytes of room past the worst-case output.
+TARGET_AVX2 static size_t encode_avx2(const uint8_t *input, size_t len, uint8_t *out) {
+    uint8_t *start = out;
+    const __m256i lo_bits = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)passthrough_lo_bits));
+    const __m256i hi_bits = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)passthrough_hi_bits));
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i len_ge2 = _mm256_set1_epi32(0x01FFFFFF);
+    const __m256i len_ge3 = _mm256_set1_epi32(0x02FFFFFF);
+    size_t i = 0;
+
+    while (i + 32 <= len) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(input + i));
+        __m256i lo = _mm256_and_si256(v, nibble);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+        __m256i bits = _mm256_and_si256(_mm256_shuffle_epi8(lo_bits, lo), _mm256_shuffle_epi8(hi_bits, hi));
+        uint32_t special = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bits, _mm256_setzero_si256()));
+
+        if (special == 0) {
+            _mm256_storeu_si256((__m256i *)out, v);
+            out += 32;
+            i += 32;
+            continue;
+        }
+
+        // Copy a leading passthrough run and restart the block at the first special
+        unsigned run = __builtin_ctz(special);
+        if (run >= 8) {
+            _mm256_storeu_si256((__m256i *)out, v);
+            out += run;
+            i += run;
+            continue;
+        }
+
+        for (int k = 0; k < 4; k++) {
+            __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(input + i + 8 * k)));
+            __m256i seq = _mm256_i32gather_epi32((const int *)encode_packed, idx, 4);
+            unsigned ge2 = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(seq, len_ge2)));
+            unsigned ge3 = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(seq, len_ge3)));
+            unsigned cls0 = (ge2 & 0x0F) | ((ge3 & 0x0F) << 4);
+            unsigned cls1 = (ge2 >> 4) | (ge3 & 0xF0);
+            __m256i shuffle = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)encode_shuffle[cls0])),
+                _mm_loadu_si128((const __m128i *)encode_shuffle[cls1]), 1);
+            __m256i packed = _mm256_shuffle_epi8(seq, shuffle);
+            _mm_storeu_si128((__m128i *)out, _mm256_castsi256_si128(packed));
+            out += encode_shuffle_len[cls0];
+            _mm_storeu_si128((__m128i *)out, _mm256_extracti128_si256(packed, 1));
+            out += encode_shuffle_len[cls1];
+        }
+        i += 32;
+    }
+
+    out += encode_scalar(input + i, len - i, out);
+    return out - start;
+}
+
+// AVX2 size kernel, same scheme as the SSE4.1 one over 32 bytes
+TARGET_AVX2 static size_t encoded_size_avx2(const uint8_t *input, size_t len) {
+    const __m256i pass_lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)passthrough_lo_bits));
+    const __m256i len3_lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)length3_lo_bits));
+    const __m256i hi_bits = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)passthrough_hi_bits));
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i total = zero;
+    size_t i = 0;
+
+    while (i + 32 <= len) {
+        __m256i acc = zero;
+        for (int round = 0; round < 127 && i + 32 <= len; round++, i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(input + i));
+            __m256i lo = _mm256_and_si256(v, nibble);
+            __m256i hi = _mm256_shuffle_epi8(hi_bits, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+            __m256i pass = _mm256_cmpeq_epi8(_mm256_and_si256(_mm256_shuffle_epi8(pass_lo, lo), hi), zero);
+            __m256i len3 = _mm256_cmpeq_epi8(_mm256_and_si256(_mm256_shuffle_epi8(len3_lo, lo), hi), zero);
+            acc = _mm256_sub_epi8(acc, pass);
+            acc = _mm256_add_epi8(acc, _mm256_andnot_si256(len3, _mm256_set1_epi8(1)));
+        }
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(acc, zero));
+    }
+
+    __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(total), _mm256_extracti128_si256(total, 1));
+    size_t extra = sum_epi64(sum);
+    return i + extra + encoded_size_scalar(input + i, len - i);
+}
+
+// AVX2 counting kernel, same scheme as the SSE4.1 one over 32 bytes
+TARGET_AVX2 static decode_counts_t count_decode_avx2(const uint8_t *input, size_t len) {
+    const __m256i space_table = _mm256_setr_epi8(' ', 0, 0, 0, 0, 0, 0, 0, 0, '\t', '\n', 0, 0, '\r', 0, 0,
+                                                 ' ', 0, 0, 0, 0, 0, 0, 0, 0, '\t', '\n', 0, 0, '\r', 0, 0);
+    const __m256i lead_min = _mm256_set1_epi8((char)0xC0);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i space_total = zero, continuation_total = zero;
+    size_t i = 0;
+
+    while (i + 32 <= len) {
+        __m256i space_acc = zero, continuation_acc = zero;
+        for (int round = 0; round < 255 && i + 32 <= len; round++, i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(input + i));
+            space_acc = _mm256_sub_epi8(space_acc, _mm256_cmpeq_epi8(_mm256_shuffle_epi8(space_table, v), v));
+            continuation_acc = _mm256_sub_epi8(continuation_acc, _mm256_cmpgt_epi8(lead_min, v));
+        }
+        space_total = _mm256_add_epi64(space_total, _mm256_sad_epu8(space_acc, zero));
+        continuation_total = _mm256_add_epi64(continuation_total, _mm256_sad_epu8(continuation_acc, zero));
+    }
+
+    decode_counts_t tail = count_decode_scalar(input + i, len - i);
+    __m128i spaces = _mm_add_epi64(_mm256_castsi256_si128(space_total), _mm256_extracti128_si256(space_total, 1));
+    __m128i conts = _mm_add_epi64(_mm256_castsi256_si128(continuation_total),
+                                  _mm256_extracti128_si256(continuation_total, 1));
+    size_t whitespace = sum_epi64(spaces);
+    size_t continuations = sum_epi64(conts);
+    return (decode_counts_t){i - whitespace - continuations + tail.leads, continuations + tail.continuations};
+}
+
+// AVX2 decode kernel, 32 input bytes per iteration (see decode_block_prefix).
+// The decoded bytes are packed with PSHUFB per 8-byte group, as in SSE4.1.
+// Writes at most len bytes to out, returns bytes written.
+TARGET_AVX2 static size_t decode_avx2(const uint8_t *input, size_t len, uint8_t *out) {
+    uint8_t *start = out;
+    const __m256i lo_bits = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)passthrough_lo_bits));
+    const __m256i hi_bits = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)passthrough_hi_bits));
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+
+    // One byte of lookahead for the continuation after each lead
+    while (i + 33 <= len) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(input + i));
+        __m256i lo = _mm256_and_si256(v, nibble);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+        __m256i bits = _mm256_and_si256(_mm256_shuffle_epi8(lo_bits, lo), _mm256_shuffle_epi8(hi_bits, hi));
+        __m256i not_passthrough = _mm256_cmpeq_epi8(bits, zero);
+        uint32_t passthrough = ~(uint32_t)_mm256_movemask_epi8(not_passthrough);
+
+        if (passthrough == 0xFFFFFFFF) {
+            _mm256_storeu_si256((__m256i *)out, v);
+            out += 32;
+            i += 32;
+            continue;
+        }
+
+        __m256i is_c4 = _mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)0xC4));
+        uint32_t lead_c3 = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)0xC3)));
+        uint32_t lead_c4 = (uint32_t)_mm256_movemask_epi8(is_c4);
+        // 0x80-0xBF are the signed bytes below -64
+        uint32_t continuation = (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_set1_epi8(-64), v));
+        uint32_t whitespace = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')))));
+        uint32_t excluded = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)0x98)), _mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)0xB8))));
+        size_t n = decode_block_prefix(passthrough, lead_c3, lead_c4, continuation, whitespace, excluded, 32);
+
+        if (n > 0) {
+            uint32_t keep = (passthrough | lead_c3 | lead_c4) & (uint32_t)((1ULL << n) - 1);
+            __m256i next = _mm256_loadu_si256((const __m256i *)(input + i + 1));
+            next = _mm256_add_epi8(next, _mm256_and_si256(is_c4, _mm256_set1_epi8(64)));
+            __m256i decoded = _mm256_blendv_epi8(v, next, not_passthrough);
+            uint64_t group[4];
+            for (int g = 0; g < 4; g++) {
+                memcpy(&group[g], decode_compress[(keep >> (8 * g)) & 0xFF], 8);
+            }
+            // PSHUFB works within 128-bit lanes: odd groups index the lane's upper half
+            __m256i idx = _mm256_setr_epi64x((long long)group[0], (long long)(group[1] + 0x0808080808080808ULL),
+                                             (long long)group[2], (long long)(group[3] + 0x0808080808080808ULL));
+            __m256i packed = _mm256_shuffle_epi8(decoded, idx);
+            __m128i lanes[2] = {_mm256_castsi256_si128(packed), _mm256_extracti128_si256(packed, 1)};
+            for (int g = 0; g < 4; g++) {
+                __m128i lane = lanes[g >> 1];
+                _mm_storel_epi64((__m128i *)out, g & 1 ? _mm_unpackhi_epi64(lane, lane) : lane);
+                out += __builtin_popcount((keep >> (8 * g)) & 0xFF);
+            }
+            i += n;
+        }
+        if (n < 32) {
+            i += decode_char(input, len, i, &out);
+        }
+    }
+    while (i < len) {
+        i += decode_char(input, len, i, &out);
+    }
+    return out - start;
+}
+
+// 256-entry byte lookup held in four zmm registers
+TARGET_AVX512 static inline __m512i lookup256_avx512(const __m512i table[4], __m512i idx) {
+    __m512i lo = _mm512_permutex2var_epi8(table[0], idx, table[1]);
+    __m512i hi = _mm512_permutex2var_epi8(table[2], idx, table[3]);
+    return _mm512_mask_blend_epi8(_mm512_movepi8_mask(idx), lo, hi);
+}
+
+// AVX-512 VBMI encode kernel, 64 input bytes per iteration with no scalar tail.
+// Each byte plane of encode_table is looked up in-register with VPERMI2B, the
+// planes are interleaved into three output vectors, and VPCOMPRESSB drops the
+// unused (zero) continuation slots. Continuation bytes are never zero, so a
+// nonzero plane 1/2 byte is exactly "this sequence has that byte".
+// Needs ENCODE_SLACK bytes of room past the worst-case output.
+TARGET_AVX512 static size_t encode_avx512(const uint8_t *input, size_t len, uint8_t *out) {
+    uint8_t *start = out;
+    __m512i planes[3][4];
+    __m512i interleave[3];
+
+    for (int j = 0; j < 3; j++) {
+        for (int q = 0; q < 4; q++) {
+            planes[j][q] = _mm512_loadu_si512(encode_planes[j] + 64 * q);
+        }
+    }
+    for (int k = 0; k < 3; k++) {
+        interleave[k] = _mm512_loadu_si512(encode_interleave[k]);
+    }
+
+    size_t i = 0;
+    while (i < len) {
+        size_t n = len - i < 64 ? len - i : 64;
+        __mmask64 in_mask = n == 64 ? ~0ULL : (1ULL << n) - 1;
+        __m512i v = _mm512_maskz_loadu_epi8(in_mask, input + i);
+        __m512i p1 = lookup256_avx512(planes[1], v);
+
+        if (n == 64 && _mm512_test_epi8_mask(p1, p1) == 0) {
+            // Pure passthrough ASCII
+            _mm512_storeu_si512(out, v);
+            out += 64;
+            i += 64;
+            continue;
+        }
+
+        __m512i p0 = lookup256_avx512(planes[0], v);
+        __m512i p2 = lookup256_avx512(planes[2], v);
+        size_t slots = 3 * n;
+
+        for (int k = 0; k < 3 && 64 * (size_t)k < slots; k++) {
+            __m512i z = _mm512_permutex2var_epi8(p0, interleave[k], p1);
+            z = _mm512_mask_permutexvar_epi8(z, encode_interleave_j2[k], interleave[k], p2);
+            __mmask64 valid = _mm512_test_epi8_mask(z, z) | encode_interleave_j0[k];
+            size_t limit = slots - 64 * k;
+            if (limit < 64) valid &= (1ULL << limit) - 1;
+
+            __m512i packed = _mm512_maskz_compress_epi8(valid, z);
+            unsigned count = (unsigned)__builtin_popcountll(valid);
+            if (n == 64) {
+                _mm512_storeu_si512(out, packed);
+            } else {
+                _mm512_mask_storeu_epi8(out, count == 64 ? ~0ULL : (1ULL << count) - 1, packed);
+            }
+            out += count;
+        }
+        i += n;
+    }
+
+    return out - start;
+}
+
+// AVX-512 size kernel: plane 1 and plane 2 lookups give the length >= 2 and
+// length 3 masks directly, counted with POPCNT
+TARGET_AVX512 static size_t encoded_size_avx512(const uint8_t *input, size_t len) {
+    __m512i plane1[4], plane2[4];
+    for (int q = 0; q < 4; q++) {
+        plane1[q] = _mm512_loadu_si512(encode_planes[1] + 64 * q);
+        plane2[q] = _mm512_loadu_si512(encode_planes[2] + 64 * q);
+    }
+
+    size_t total = len;
+    for (size_t i = 0; i < len; i += 64) {
+        __mmask64 in_mask = len - i >= 64 ? ~0ULL : (1ULL << (len - i)) - 1;
+        __m512i v = _mm512_maskz_loadu_epi8(in_mask, input + i);
+        __m512i p1 = lookup256_avx512(plane1, v);
+        __m512i p2 = lookup256_avx512(plane2, v);
+        total += (size_t)__builtin_popcountll(_mm512_mask_test_epi8_mask(in_mask, p1, p1));
+        total += (size_t)__builtin_popcountll(_mm512_mask_test_epi8_mask(in_mask, p2, p2));
+    }
+    return total;
+}
+
+// AVX-512 counting kernel: the SSE4.1 classification into masks, counted
+// with POPCNT; masked loads cover the tail
+TARGET_AVX512 static decode_counts_t count_decode_avx512(const uint8_t *input, size_t len) {
+    const __m512i space_table = _mm512_broadcast_i32x4(
+        _mm_setr_epi8(' ', 0, 0, 0, 0, 0, 0, 0, 0, '\t', '\n', 0, 0, '\r', 0, 0));
+    const __m512i lead_min = _mm512_set1_epi8((char)0xC0);
+    size_t whitespace = 0, continuations = 0;
+    for (size_t i = 0; i < len; i += 64) {
+        __mmask64 in_mask = len - i >= 64 ? ~0ULL : (1ULL << (len - i)) - 1;
+        __m512i v = _mm512_maskz_loadu_epi8(in_mask, input + i);
+        whitespace += (size_t)__builtin_popcountll(
+            _mm512_mask_cmpeq_epi8_mask(in_mask, _mm512_shuffle_epi8(space_table, v), v));
+        continuations += (size_t)__builtin_popcountll(_mm512_mask_cmplt_epi8_mask(in_mask, v, lead_min));
+    }
+    return (decode_counts_t){len - whitespace - continuations, continuations};
+}
+
+// AVX-512 decode kernel, 64 input bytes per iteration (see
+// decode_block_prefix). VPCOMPRESSB packs the decoded bytes.
+// Writes at most len bytes to out, returns bytes written.
+TARGET_AVX512 static size_t decode_avx512(const uint8_t *input, size_t len, uint8_t *out) {
+    uint8_t *start = out;
+    const __m512i lo_bits = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)passthrough_lo_bits));
+    const __m512i hi_bits = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)passthrough_hi_bits));
+    const __m512i nibble = _mm512_set1_epi8(0x0F);
+    size_t i = 0;
+
+    // One byte of lookahead for the continuation after each lead
+    while (i + 65 <= len) {
+        __m512i v = _mm512_loadu_si512(input + i);
+        __m512i lo = _mm512_and_si512(v, nibble);
+        __m512i hi = _mm512_and_si512(_mm512_srli_epi16(v, 4), nibble);
+        __m512i bits = _mm512_and_si512(_mm512_shuffle_epi8(lo_bits, lo), _mm512_shuffle_epi8(hi_bits, hi));
+        uint64_t passthrough = _mm512_test_epi8_mask(bits, bits);
+
+        if (passthrough == ~0ULL) {
+            _mm512_storeu_si512(out, v);
+            out += 64;
+            i += 64;
+            continue;
+        }
+
+        uint64_t lead_c3 = _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8((char)0xC3));
+        uint64_t lead_c4 = _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8((char)0xC4));
+        // 0x80-0xBF are the signed bytes below -64
+        uint64_t continuation = _mm512_cmplt_epi8_mask(v, _mm512_set1_epi8(-64));
+        uint64_t whitespace = _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(' ')) |
+                              _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('\n')) |
+                              _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('\t')) |
+                              _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('\r'));
+        uint64_t excluded = _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8((char)0x98)) |
+                            _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8((char)0xB8));
+        size_t n = decode_block_prefix(passthrough, lead_c3, lead_c4, continuation, whitespace, excluded, 64);
+
+        if (n > 0) {
+            uint64_t keep = (passthrough | lead_c3 | lead_c4) & (n == 64 ? ~0ULL : (1ULL << n) - 1);
+            __m512i next = _mm512_loadu_si512(input + i + 1);
+            next = _mm512_mask_add_epi8(next, lead_c4, next, _mm512_set1_epi8(64));
+            __m512i decoded = _mm512_mask_blend_epi8(passthrough, next, v);
+            // Output never runs ahead of input, so the full store stays inside out[0, len)
+            _mm512_storeu_si512(out, _mm512_maskz_compress_epi8(keep, decoded));
+            out += __builtin_popcountll(keep);
+            i += n;
+        }
+        if (n < 64) {
+            i += decode_char(input, len, i, &out);
+        }
+    }
+    while (i < len) {
+        i += decode_char(input, len, i, &out);
+    }
+    return out - start;
+}
+
+static bool cpu_has_sse41(void) {
+    return __builtin_cpu_supports("sse4.1");
+}
+
+static bool cpu_has_avx2(void) {
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+}
+
+static bool cpu_has_avx512(void) {
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+           __builtin_cpu_supports("avx512vbmi") && __builtin_cpu_supports("avx512vbmi2") &&
+           __builtin_cpu_supports("popcnt");
+}
+#endif
+
+static bool cpu_has_baseline(void) {
+    return true;
+}
+
+// Encode/decode kernel variants, best first
+typedef struct {
+    const char *name;
+    bool (*supported)(void);
+    size_t (*encode)(const uint8_t *input, size_t len, uint8_t *out);
+    size_t (*encoded_size)(const uint8_t *input, size_t len);
+    size_t (*decode)(const uint8_t *input, size_t len, uint8_t *out);
+    decode_counts_t (*count_decode)(const uint8_t *input, size_t len);
+} kernel_t;
+
+static const kernel_t kernels[] = {
+#if PB_X86_KERNELS
+    {"avx512", cpu_has_avx512, encode_avx512, encoded_size_avx512, decode_avx512, count_decode_avx512},
+    {"avx2", cpu_has_avx2, encode_avx2, encoded_size_avx2, decode_avx2, count_decode_avx2},
+    {"sse41", cpu_has_sse41, encode_sse41, encoded_size_sse41, decode_sse41, count_decode_sse41},
+#endif
+    {"scalar", cpu_has_baseline, encode_scalar, encoded_size_scalar, decode_scalar, count_decode_scalar},
+};
+
+#define KERNEL_COUNT (sizeof(kernels) / sizeof(kernels[0]))
+
+// Kernel in use, picked once at startup by select_kernel
+static const kernel_t *kernel = &kernels[KERNEL_COUNT - 1];
+
+// Pick the named kernel, or the best one this CPU supports when name is NULL
+static void select_kernel(const char *name) {
+#if PB_X86_KERNELS
+    __builtin_cpu_init();
+#endif
+    for (size_t k = 0; k < KERNEL_COUNT; k++) {
+        if (name ? strcmp(name, kernels[k].name) == 0 : kernels[k].supported()) {
+            if (!kernels[k].supported()) {
+                fprintf(stderr, "Error: kernel '%s' is not supported on this CPU\n", name);
+                exit(1);
+            }
+            kernel = &kernels[k];
+            return;
+        }
+    }
+    fprintf(stderr, "Error: unknown kernel '%s'\n", name);
+    exit(1);
+}
+
+// Print the selected kernel and every kernel this CPU can run
+static void print_kernels(void) {
+    printf("Selected kernel: %s\n", kernel->name);
+    printf("Supported kernels:");
+    for (size_t k = 0; k < KERNEL_COUNT; k++) {
+        if (kernels[k].supported()) {
+            printf(" %s", kernels[k].name);
+        }
+    }
+    printf("\n");
+}
+
+// Output layout for -f. Every input byte encodes to exactly one character,
+// so separators are placed by input position: one before each input byte
+// whose index is a nonzero multiple of group_size, a newline every
+// groups_per_line groups and a space otherwise. group_size 0 means no
+// formatting.
+typedef struct {
+    size_t group_size;
+    size_t groups_per_line;
+} format_t;
+
+// Number of separators before input bytes [0, end)
+static size_t separators_before(const format_t *format, size_t end) {
+    return format->group_size && end > 0 ? (end - 1) / format->group_size : 0;
+}
+
+// Number of separators written along with input bytes [pos, pos + len)
+static size_t separators_in(const format_t *format, size_t pos, size_t len) {
+    return separators_before(format, pos + len) - separators_before(format, pos);
+}
+
+// Encode len input bytes that sit at position pos of the whole input
+// straight into their formatted layout: the kernel runs once per group and
+// the separators are written in between. pos fixes where the group
+// boundaries fall. Needs ENCODE_SLACK bytes of room past the output.
+static size_t encode_range(const uint8_t *input, size_t len, size_t pos, uint8_t *out,
+                           const format_t *format) {
+    if (format->group_size == 0) {
+        return kernel->encode(input, len, out);
+    }
+
+    uint8_t *begin = out;
+    size_t i = 0;
+    while (i < len) {
+        size_t group = (pos + i) / format->group_size;
+        size_t next = (group + 1) * format->group_size - pos;
+        if (pos + i > 0 && pos + i == group * format->group_size) {
+            *out++ = group % format->groups_per_line == 0 ? '\n' : ' ';
+        }
+        if (next > len) {
+            next = len;
+        }
+        out += kernel->encode(input + i, next - i, out);
+        i = next;
+    }
+    return out - begin;
+}
+
+// Encode a whole in-memory input to printable UTF-8, formatted if requested.
+// A length pre-pass sizes the output exactly, so it is allocated once and
+// the kernel writes it without capacity checks.
+static buffer_t encode_data(const uint8_t *input, size_t input_len, const format_t *format) {
+    buffer_t output;
+    size_t encoded_len = kernel->encoded_size(input, input_len) + separators_in(format, 0, input_len);
+    buffer_init(&output, encoded_len + ENCODE_SLACK);
+
+    output.size = encode_range(input, input_len, 0, (uint8_t *)output.data, format);
+
+    buffer_prepare_return(&output);
+    return output;
+}
+
+// Encode into a region that ends exactly where the encoded output does.
+// The last ENCODE_SLACK input bytes go through a bounce buffer, so the
+// kernel's over-stores stay inside the region (every input byte produces at
+// least one output byte).
+static size_t encode_bounded(const uint8_t *input, size_t len, size_t pos, uint8_t *out,
+                             const format_t *format) {
+    // Worst case: every byte at full expansion, each preceded by a separator
+    uint8_t tail[ENCODE_SLACK * (ENCODE_MAX_EXPANSION + 1) + ENCODE_SLACK];
+    size_t head = len > ENCODE_SLACK ? len - ENCODE_SLACK : 0;
+    size_t written = encode_range(input, head, pos, out, format);
+    size_t tail_len = encode_range(input + head, len - head, pos + head, tail, format);
+    memcpy(out + written, tail, tail_len);
+    return written + tail_len;
+}
+
+// One thread's share of a parallel encode: a contiguous run of chunks
+typedef struct {
+    const uint8_t *input;
+    size_t input_len;
+    size_t pos;  // Position of input within the whole input
+    size_t first_chunk;
+    size_t end_chunk;
+    const format_t *format;
+    size_t *offsets;  // Per chunk: encoded size after sizing, output offset when writing
+    uint8_t *output;
+} encode_job_t;
+
+static void *encode_job_size(void *arg) {
+    encode_job_t *job = arg;
+    for (size_t c = job->first_chunk; c < job->end_chunk; c++) {
+        size_t start = c * PARALLEL_CHUNK_SIZE;
+        size_t len = job->input_len - start < PARALLEL_CHUNK_SIZE ? job->input_len - start : PARALLEL_CHUNK_SIZE;
+        job->offsets[c] = kernel->encoded_size(job->input + start, len) +
+                          separators_in(job->format, job->pos + start, len);
+    }
+    return NULL;
+}
+
+static void *encode_job_write(void *arg) {
+    encode_job_t *job = arg;
+    for (size_t c = job->first_chunk; c < job->end_chunk; c++) {
+        size_t start = c * PARALLEL_CHUNK_SIZE;
+        size_t len = job->input_len - start < PARALLEL_CHUNK_SIZE ? job->input_len - start : PARALLEL_CHUNK_SIZE;
+        encode_bounded(job->input + start, len, job->pos + start, job->output + job->offsets[c], job->format);
+    }
+    return NULL;
+}
+
+// Worker threads for run_jobs. They are started on first use and then live
+// for the rest of the process, so a stream pays for thread creation once
+// rather than twice per block. Each batch's jobs are claimed one at a time
+// under the lock, and the calling thread claims them too, so a batch finishes
+// even if no worker could be started.
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work;  // A batch has jobs left to claim
+    pthread_cond_t done;  // The batch's last job finished
+    int workers;
+    void *(*fn)(void *);
+    char *jobs;
+    size_t job_size;
+    int count;
+    int next;     // Next job to claim
+    int pending;  // Jobs claimed or not, still unfinished
+} pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+// Claim and run the current batch's jobs until none are left; called and
+// returns with pool.lock held
+static void pool_drain(void) {
+    while (pool.next < pool.count) {
+        void *job = pool.jobs + pool.next++ * pool.job_size;
+        void *(*fn)(void *) = pool.fn;
+        pthread_mutex_unlock(&pool.lock);
+        fn(job);
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.pending == 0) {
+            pthread_cond_signal(&pool.done);
+        }
+    }
+}
+
+static void *pool_worker(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        while (pool.next >= pool.count) {
+            pthread_cond_wait(&pool.work, &pool.lock);
+        }
+        pool_drain();
+    }
+    return NULL;
+}
+
+// Run fn over every job (an array of count jobs, job_size bytes each) on the
+// worker pool and the calling thread, returning once all of them are done
+static void run_jobs(void *(*fn)(void *), void *jobs, size_t job_size, int count) {
+    pthread_mutex_lock(&pool.lock);
+    // The caller is one of the threads, so count - 1 workers are enough
+    while (pool.workers < count - 1) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, pool_worker, NULL) != 0) {
+            break;
+        }
+        pthread_detach(thread);
+        pool.workers++;
+    }
+    pool.fn = fn;
+    pool.jobs = jobs;
+    pool.job_size = job_size;
+    pool.count = count;
+    pool.next = 0;
+    pool.pending = count;
+    pthread_cond_broadcast(&pool.work);
+    pool_drain();
+    while (pool.pending > 0) {
+        pthread_cond_wait(&pool.done, &pool.lock);
+    }
+    pool.count = 0;
+    pthread_mutex_unlock(&pool.lock);
+}
+
+// Encode on several threads. The input is split into cache-sized chunks;
+// each chunk's encoded length is computed in parallel, an exclusive prefix
+// sum turns lengths into output offsets, and the threads then encode
+// straight into out, which needs room for the worst case plus ENCODE_SLACK.
+// Returns bytes written.
+static size_t encode_parallel(const uint8_t *input, size_t input_len, size_t pos, uint8_t *out,
+                              const format_t *format, int thread_count) {
+    size_t chunks = (input_len + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE;
+    if (chunks < 2) {
+        return encode_range(input, input_len, pos, out, format);
+    }
+    if ((size_t)thread_count > chunks) {
+        thread_count = (int)chunks;
+    }
+
+    size_t *offsets = malloc(chunks * sizeof(size_t));
+    encode_job_t *jobs = malloc(thread_count * sizeof(encode_job_t));
+    if (!offsets || !jobs) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    for (int t = 0; t < thread_count; t++) {
+        jobs[t] = (encode_job_t){
+            .input = input,
+            .input_len = input_len,
+            .pos = pos,
+            .first_chunk = chunks * t / thread_count,
+            .end_chunk = chunks * (t + 1) / thread_count,
+            .format = format,
+            .offsets = offsets,
+            .output = out
+        };
+    }
+
+    run_jobs(encode_job_size, jobs, sizeof(encode_job_t), thread_count);
+
+    // Exclusive prefix sum: chunk sizes become write offsets
+    size_t total = 0;
+    for (size_t c = 0; c < chunks; c++) {
+        size_t size = offsets[c];
+        offsets[c] = total;
+        total += size;
+    }
+
+    run_jobs(encode_job_write, jobs, sizeof(encode_job_t), thread_count);
+
+    free(jobs);
+    free(offsets);
+    return total;
+}
+
+// Open the input file, or stdin when no file (or "-") is given
+static int open_input(const char *filename) {
+    if (!filename || strcmp(filename, "-") == 0) {
+        return STDIN_FILENO;
+    }
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening file");
+        exit(1);
+    }
+    return fd;
+}
+
+// A regular input file mapped read-only, so blocks are encoded or decoded
+// straight from the page cache with no copy into a buffer of our own. Memory
+// use still doesn't grow with the file: the mapping's pages are clean page
+// cache, reclaimable at any time, not anonymous memory. data is NULL for
+// pipes, ttys, empty files and anywhere mmap isn't available; those are
+// read() block by block.
+//
+// The mapping starts where the fd's offset is (stdin may be a file someone
+// has already read part of), and map_close leaves the offset at the end of
+// the file, as if it had all been read.
+typedef struct {
+    const uint8_t *data;   // Input from the fd's offset on
+    size_t size;
+    size_t offset;         // File offset of data
+    size_t skip;           // Bytes mapped before data, to start on a page
+    int fd;
+} mapped_input_t;
+
+static mapped_input_t map_input(int fd) {
+    mapped_input_t map = {0};
+#if PB_MMAP
+    struct stat st;
+    off_t start = lseek(fd, 0, SEEK_CUR);
+    if (start < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= start ||
+        (uint64_t)st.st_size > SIZE_MAX) {
+        return map;
+    }
+    size_t skip = (size_t)start % (size_t)sysconf(_SC_PAGESIZE);
+    size_t length = (size_t)st.st_size - (size_t)start + skip;
+    void *data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, start - (off_t)skip);
+    if (data == MAP_FAILED) {
+        return map;
+    }
+    // Read ahead aggressively and let pages behind go early. Populating the
+    // whole mapping up front would fault in a large file before any output
+    // is written.
+    madvise(data, length, MADV_SEQUENTIAL);
+    map.data = (const uint8_t *)data + skip;
+    map.size = length - skip;
+    map.offset = (size_t)start;
+    map.skip = skip;
+    map.fd = fd;
+#else
+    (void)fd;
+#endif
+    return map;
+}
+
+// Unmap the pages of map->data[start, end), a finished block, to keep the
+// resident set to the blocks in flight. The page cache keeps the data.
+static void map_release(const mapped_input_t *map, size_t start, size_t end) {
+#if PB_MMAP
+    // Only whole pages of the mapping; the partial ones at either end go
+    // with the next release
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    end = (map->skip + end) / page * page;
+    start = (map->skip + start) / page * page;
+    if (start < end) {
+        madvise((void *)(map->data - map->skip + start), end - start, MADV_DONTNEED);
+    }
+#else
+    (void)map, (void)start, (void)end;
+#endif
+}
+
+static void map_close(const mapped_input_t *map) {
+#if PB_MMAP
+    if (map->data) {
+        munmap((void *)(map->data - map->skip), map->skip + map->size);
+        lseek(map->fd, (off_t)(map->offset + map->size), SEEK_SET);
+    }
+#else
+    (void)map;
+#endif
+}
+
+// Read up to size bytes of input. Returns as soon as some data is available,
+// or with fill set only once the block is full or the input has ended.
+// Returns 0 at end of input.
+static size_t read_block(int fd, uint8_t *block, size_t size, bool fill) {
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = read(fd, block + got, size - got);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error reading input");
+            exit(1);
+        }
+        if (n == 0) {
+            break;
+        }
+        got += (size_t)n;
+        if (!fill) {
+            break;
+        }
+    }
+    return got;
+}
+
+// A write to stdout or stderr failed. A reader that has gone away (EPIPE,
+// when whoever started us ignores SIGPIPE) ends the run the way SIGPIPE
+// would have, quietly; anything else is an error.
+static COLD void write_failed(void) {
+#if !defined(_WIN32)
+    if (errno == EPIPE) {
+        signal(SIGPIPE, SIG_DFL);
+        raise(SIGPIPE);
+    }
+#endif
+    perror("Error writing output");
+    exit(1);
+}
+
+// Write all len bytes to fd with write(2), bypassing stdio: short writes
+// (including the kernel's ~2 GB cap per call) are continued, EINTR is
+// retried, and a full non-blocking fd (EAGAIN) is waited on.
+static void write_all(int fd, const void *data, size_t len) {
+    const uint8_t *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+#if !defined(_WIN32)
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd ready = {.fd = fd, .events = POLLOUT};
+                poll(&ready, 1, -1);
+                continue;
+            }
+#endif
+            write_failed();
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+}
+
+// Input bytes per stream block. Parallel runs fill a block with one chunk
+// (or share) per thread.
+static size_t stream_block_size(int jobs) {
+    if (jobs > 1 && (size_t)jobs * PARALLEL_CHUNK_SIZE > STREAM_BLOCK_SIZE) {
+        return (size_t)jobs * PARALLEL_CHUNK_SIZE;
+    }
+    return STREAM_BLOCK_SIZE;
+}
+
+// --passthrough copies the original data to stdout without it passing
+// through user space when stdout is a pipe: a piped input is duplicated onto
+// stdout with tee(2) before the same bytes are read for encoding, and blocks
+// of a mapped file are spliced to stdout from the page cache. Anything else
+// (stdout a file or terminal, or no splice support) uses plain writes.
+typedef enum {
+    PASSTHROUGH_OFF,
+    PASSTHROUGH_COPY,
+    PASSTHROUGH_TEE,
+    PASSTHROUGH_SPLICE
+} passthrough_t;
+
+static passthrough_t passthrough_start(int fd, bool mapped) {
+#if PB_SPLICE
+    struct stat st;
+    if (fstat(STDOUT_FILENO, &st) != 0 || !S_ISFIFO(st.st_mode)) {
+        return PASSTHROUGH_COPY;
+    }
+    // Larger pipes move a whole block per call instead of 64 KB; best effort,
+    // as the size is capped by /proc/sys/fs/pipe-max-size
+    fcntl(STDOUT_FILENO, F_SETPIPE_SZ, STREAM_BLOCK_SIZE);
+    if (mapped) {
+        return PASSTHROUGH_SPLICE;
+    }
+    if (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+        fcntl(fd, F_SETPIPE_SZ, STREAM_BLOCK_SIZE);
+        return PASSTHROUGH_TEE;
+    }
+#else
+    (void)fd, (void)mapped;
+#endif
+    return PASSTHROUGH_COPY;
+}
+
+#if PB_SPLICE
+// tee or splice from the input to stdout failed, and either end may be at
+// fault. A stdout whose reader has gone away polls as POLLERR and goes to
+// write_failed; anything else is reported the way read_block reports it.
+static COLD void splice_failed(void) {
+    int err = errno;
+    struct pollfd out = {.fd = STDOUT_FILENO};
+    bool closed = poll(&out, 1, 0) == 1 && (out.revents & POLLERR);
+    errno = err;
+    if (closed) {
+        write_failed();
+    }
+    perror("Error reading input");
+    exit(1);
+}
+
+// Like read_block, but first duplicates the bytes onto stdout with tee(2).
+// tee only copies what is in the input pipe, so each call is followed by a
+// read of exactly that much, which the pipe already holds.
+static size_t tee_block(int fd, uint8_t *block, size_t size, bool fill) {
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = tee(fd, STDOUT_FILENO, size - got, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            splice_failed();
+        }
+        if (n == 0) {
+            break;
+        }
+        if (read_block(fd, block + got, (size_t)n, true) != (size_t)n) {
+            fprintf(stderr, "Error reading input: pipe drained under tee\n");
+            exit(1);
+        }
+        got += (size_t)n;
+        if (!fill) {
+            break;
+        }
+    }
+    return got;
+}
+
+// Send len bytes of the input file at pos to stdout with splice(2)
+static void splice_block(int fd, size_t pos, size_t len) {
+    loff_t offset = (loff_t)pos;
+    while (len > 0) {
+        ssize_t n = splice(fd, &offset, STDOUT_FILENO, NULL, len, SPLICE_F_MORE);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            splice_failed();
+        }
+        if (n == 0) {
+            // The mapping was sized from the file, so it has shrunk since
+            fprintf(stderr, "Error reading input: file ended early\n");
+            exit(1);
+        }
+        len -= (size_t)n;
+    }
+}
+#endif
+
+#if PB_IO_URING
+// --io-uring: stream a regular input file through io_uring. A fixed pool of
+// buffers, registered with the ring when RLIMIT_MEMLOCK allows, keeps up to
+// URING_DEPTH blocks of input being read ahead of the block being encoded or
+// decoded, and up to URING_DEPTH finished blocks being written behind it.
+// Writes to a regular file go out together at explicit offsets; to a pipe,
+// terminal or O_APPEND file, one at a time so they stay in order.
+
+// One buffer of the pool and the transfer it is part of
+typedef struct {
+    size_t offset;   // File offset of the transfer
+    size_t done;     // Bytes transferred so far
+    size_t len;      // Bytes to transfer
+    bool busy;
+} uring_slot_t;
+
+typedef struct {
+    int fd;
+    bool fixed;                  // Buffers are registered
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned sq_entries;
+    unsigned to_submit;
+
+    size_t block_size;
+    int in_fd;
+    size_t in_start;             // Input file offset where the stream starts
+    size_t in_size;              // Bytes from there to the end of the file
+    uint8_t *in_buffers;         // URING_DEPTH buffers of in_capacity
+    size_t in_capacity;          // URING_CARRY_ROOM + block_size
+    uring_slot_t in[URING_DEPTH];
+    size_t in_issued;            // Blocks read or being read
+    size_t in_next;              // Blocks handed out
+    size_t in_released;          // Blocks handed back
+
+    uint8_t *out_buffers;        // URING_DEPTH buffers of out_capacity
+    size_t out_capacity;
+    uring_slot_t out[URING_DEPTH];
+    bool out_serial;             // One write in flight at a time
+    size_t out_offset;           // Output file offset of the next write
+    size_t out_next;             // Writes queued
+    size_t out_issued;           // Writes submitted
+    size_t out_completed;        // Writes finished
+} uring_t;
+
+#define URING_WRITE (1ULL << 32)  // user_data flag; the low bits are the slot
+
+static void uring_queue(uring_t *ring, bool write, unsigned k) {
+    uring_slot_t *slot = write ? &ring->out[k] : &ring->in[k];
+    uint8_t *buffer = write ? ring->out_buffers + k * ring->out_capacity
+                            : ring->in_buffers + k * ring->in_capacity + URING_CARRY_ROOM;
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    if (ring->fixed) {
+        sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->buf_index = write ? URING_DEPTH + k : k;
+    } else {
+        sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+    }
+    sqe->fd = write ? STDOUT_FILENO : ring->in_fd;
+    // -1: the file's own position, for outputs written in order
+    sqe->off = write && ring->out_serial ? (uint64_t)-1 : (uint64_t)(slot->offset + slot->done);
+    sqe->addr = (uint64_t)(uintptr_t)(buffer + slot->done);
+    sqe->len = (uint32_t)(slot->len - slot->done);
+    sqe->user_data = (write ? URING_WRITE : 0) | k;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+}
+
+static void uring_enter(uring_t *ring, unsigned wait) {
+    for (;;) {
+        long n = syscall(SYS_io_uring_enter, ring->fd, ring->to_submit, wait,
+                         wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (n >= 0) {
+            ring->to_submit -= (unsigned)n;
+            return;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            perror("Error submitting I/O");
+            exit(1);
+        }
+    }
+}
+
+// Submit queued writes that may go out now
+static void uring_pump_writes(uring_t *ring) {
+    while (ring->out_issued < ring->out_next &&
+           (!ring->out_serial || ring->out_completed == ring->out_issued)) {
+        uring_queue(ring, true, (unsigned)(ring->out_issued++ % URING_DEPTH));
+    }
+}
+
+static void uring_complete(uring_t *ring, uint64_t user_data, int res) {
+    bool write = (user_data & URING_WRITE) != 0;
+    unsigned k = (unsigned)(user_data & ~URING_WRITE);
+    uring_slot_t *slot = write ? &ring->out[k] : &ring->in[k];
+    if (res == -EINTR || res == -EAGAIN) {
+        uring_queue(ring, write, k);
+        return;
+    }
+    if (res < 0 || (write && res == 0)) {
+        errno = res < 0 ? -res : EIO;
+        if (write) {
+            write_failed();
+        }
+        perror("Error reading input");
+        exit(1);
+    }
+    if (res == 0) {
+        // The input file shrank; this block ends here
+        slot->len = slot->done;
+    }
+    slot->done += (size_t)res;
+    if (slot->done < slot->len) {
+        uring_queue(ring, write, k);
+        return;
+    }
+    slot->busy = false;
+    if (write) {
+        ring->out_completed++;
+        uring_pump_writes(ring);
+    }
+}
+
+// Submit what is queued and handle completions, waiting for at least one
+static void uring_wait(uring_t *ring) {
+    uring_enter(ring, 1);
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        uint64_t user_data = cqe->user_data;
+        int res = cqe->res;
+        __atomic_store_n(ring->cq_head, ++head, __ATOMIC_RELEASE);
+        uring_complete(ring, user_data, res);
+    }
+}
+
+// Start reads of the blocks after those handed out, up to URING_DEPTH ahead
+static void uring_read_ahead(uring_t *ring) {
+    while (ring->in_issued < ring->in_released + URING_DEPTH &&
+           ring->in_issued * ring->block_size < ring->in_size) {
+        size_t start = ring->in_issued * ring->block_size;
+        size_t left = ring->in_size - start;
+        ring->in[ring->in_issued++ % URING_DEPTH] = (uring_slot_t){
+            .offset = ring->in_start + start,
+            .len = left < ring->block_size ? left : ring->block_size,
+            .busy = true,
+        };
+        uring_queue(ring, false, (unsigned)((ring->in_issued - 1) % URING_DEPTH));
+    }
+    if (ring->to_submit > 0) {
+        uring_enter(ring, 0);
+    }
+}
+
+// Wait for the next block of input. Returns its data, with URING_CARRY_ROOM
+// writable bytes before it, or NULL at the end of the input.
+static uint8_t *uring_next_input(uring_t *ring, size_t *len) {
+    uring_read_ahead(ring);
+    if (ring->in_next * ring->block_size >= ring->in_size) {
+        return NULL;
+    }
+    unsigned k = (unsigned)(ring->in_next % URING_DEPTH);
+    while (ring->in[k].busy) {
+        uring_wait(ring);
+    }
+    *len = ring->in[k].len;
+    if (*len == 0) {
+        return NULL;
+    }
+    ring->in_next++;
+    return ring->in_buffers + k * ring->in_capacity + URING_CARRY_ROOM;
+}
+
+// Hand back the oldest block from uring_next_input for reading into
+static void uring_release_input(uring_t *ring) {
+    ring->in_released++;
+    uring_read_ahead(ring);
+}
+
+// Wait for a free buffer to put the next write in
+static uint8_t *uring_output(uring_t *ring) {
+    unsigned k = (unsigned)(ring->out_next % URING_DEPTH);
+    while (ring->out[k].busy) {
+        uring_wait(ring);
+    }
+    return ring->out_buffers + k * ring->out_capacity;
+}
+
+// Write len bytes of the buffer from uring_output
+static void uring_write(uring_t *ring, size_t len) {
+    if (len == 0) {
+        return;
+    }
+    ring->out[ring->out_next++ % URING_DEPTH] = (uring_slot_t){
+        .offset = ring->out_offset,
+        .len = len,
+        .busy = true,
+    };
+    ring->out_offset += len;
+    uring_pump_writes(ring);
+    if (ring->to_submit > 0) {
+        uring_enter(ring, 0);
+    }
+}
+
+// Wait for every write to finish
+static void uring_drain(uring_t *ring) {
+    while (ring->out_completed < ring->out_next) {
+        uring_wait(ring);
+    }
+}
+
+static void uring_free(uring_t *ring) {
+    close(ring->fd);
+    munmap(ring->sqes, ring->sq_entries * sizeof(struct io_uring_sqe));
+    if (ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    free(ring->in_buffers);
+    free(ring->out_buffers);
+}
+
+// Set up a ring for streaming in_fd in blocks of block_size, with output
+// buffers of out_capacity. Returns false if in_fd is not a regular file or
+// io_uring is unavailable (old kernel, seccomp, io_uring_disabled).
+static bool uring_init(uring_t *ring, int in_fd, size_t block_size, size_t out_capacity) {
+    struct stat st;
+    off_t in_start = lseek(in_fd, 0, SEEK_CUR);
+    if (fstat(in_fd, &st) != 0 || !S_ISREG(st.st_mode) || in_start < 0) {
+        return false;
+    }
+    memset(ring, 0, sizeof(*ring));
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    // Each buffer has at most one request outstanding
+    ring->fd = (int)syscall(SYS_io_uring_setup, 2 * URING_DEPTH, &params);
+    if (ring->fd < 0) {
+        return false;
+    }
+    // Ordered writes rely on offset -1 meaning the file position (5.6+)
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        close(ring->fd);
+        return false;
+    }
+
+    ring->sq_entries = params.sq_entries;
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = params.features & IORING_FEAT_SINGLE_MMAP ? ring->sq_ring
+        : mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+               ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        perror("Error mapping io_uring");
+        exit(1);
+    }
+    uint8_t *sq = ring->sq_ring, *cq = ring->cq_ring;
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    ring->block_size = block_size;
+    ring->in_fd = in_fd;
+    ring->in_start = (size_t)in_start;
+    ring->in_size = (size_t)st.st_size > (size_t)in_start ? (size_t)st.st_size - (size_t)in_start : 0;
+    ring->in_capacity = URING_CARRY_ROOM + block_size;
+    ring->out_capacity = out_capacity;
+    ring->in_buffers = malloc(URING_DEPTH * ring->in_capacity);
+    ring->out_buffers = malloc(URING_DEPTH * out_capacity);
+    if (!ring->in_buffers || !ring->out_buffers) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    // Registered buffers are pinned once instead of per request; they count
+    // against RLIMIT_MEMLOCK, so plain reads and writes are the fallback
+    struct iovec iov[2 * URING_DEPTH];
+    for (int k = 0; k < URING_DEPTH; k++) {
+        iov[k] = (struct iovec){ring->in_buffers + k * ring->in_capacity, ring->in_capacity};
+        iov[URING_DEPTH + k] = (struct iovec){ring->out_buffers + k * out_capacity, out_capacity};
+    }
+    ring->fixed = syscall(SYS_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov, 2 * URING_DEPTH) == 0;
+
+    // Parallel writes need a regular output file written at its position
+    off_t out_start = lseek(STDOUT_FILENO, 0, SEEK_CUR);
+    int flags = fcntl(STDOUT_FILENO, F_GETFL);
+    ring->out_serial = fstat(STDOUT_FILENO, &st) != 0 || !S_ISREG(st.st_mode) || out_start < 0 ||
+                       flags < 0 || (flags & O_APPEND);
+    ring->out_offset = ring->out_serial ? 0 : (size_t)out_start;
+    return true;
+}
+
+// Wait for outstanding I/O and release the ring. Leaves both files at the
+// position the blocking path would have.
+static void uring_finish(uring_t *ring) {
+    uring_drain(ring);
+    for (int k = 0; k < URING_DEPTH; k++) {
+        while (ring->in[k].busy) {
+            uring_wait(ring);
+        }
+    }
+    if (!ring->out_serial) {
+        lseek(STDOUT_FILENO, (off_t)ring->out_offset, SEEK_SET);
+    }
+    size_t consumed = ring->in_next * ring->block_size;
+    lseek(ring->in_fd, (off_t)(ring->in_start + (consumed < ring->in_size ? consumed : ring->in_size)), SEEK_SET);
+    uring_free(ring);
+}
+#endif
+
+// --monitor: passthrough for live streams. Each read is forwarded as soon
+// as it arrives; its encoding is held until flush_bytes are pending or
+// flush_ms have passed since the oldest, then written to stderr only as
+// far as stderr takes it without blocking. The rest is dropped and counted,
+// so a slow reader of the encoded view never holds up the data.
+typedef struct {
+    size_t flush_bytes;
+    int flush_ms;
+} monitor_t;
+
+static uint64_t monotonic_ms(void) {
+#if !defined(_WIN32)
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+#else
+    return 0;
+#endif
+}
+
+// Wait up to ms for input on fd. Returns false on timeout.
+static bool input_ready(int fd, int ms) {
+#if !defined(_WIN32)
+    struct pollfd ready = {.fd = fd, .events = POLLIN};
+    return poll(&ready, 1, ms) != 0;
+#else
+    (void)fd, (void)ms;
+    return true;
+#endif
+}
+
+// Write encoded text to stderr as far as it goes without blocking, in
+// pieces of at most PIPE_BUF (which a pipe reporting POLLOUT takes whole)
+// that end on character boundaries. Returns the bytes dropped.
+static size_t monitor_flush(const uint8_t *data, size_t len) {
+    size_t done = 0;
+#if !defined(_WIN32)
+    while (done < len) {
+        struct pollfd ready = {.fd = STDERR_FILENO, .events = POLLOUT};
+        if (poll(&ready, 1, 0) <= 0 || !(ready.revents & POLLOUT)) {
+            break;
+        }
+        size_t n = len - done;
+        if (n > PIPE_BUF) {
+            n = PIPE_BUF;
+            while ((data[done + n] & 0xC0) == 0x80) {
+                n--;
+            }
+        }
+        write_all(STDERR_FILENO, data + done, n);
+        done += n;
+    }
+#else
+    write_all(STDERR_FILENO, data, len);
+    done = len;
+#endif
+    return len - done;
+}
+
+// Encode a file or stdin block by block, writing each block's output as soon
+// as it is encoded, so memory stays bounded whatever the input size. Each
+// block's position in the stream keeps -f grouping continuous across blocks.
+static void encode_stream(const char *filename, const format_t *format, int jobs, bool passthrough,
+                          const monitor_t *monitor) {
+    int fd = open_input(filename);
+    mapped_input_t map = map_input(fd);
+    passthrough_t pass = passthrough ? passthrough_start(fd, map.data != NULL) : PASSTHROUGH_OFF;
+    int out = passthrough ? STDERR_FILENO : STDOUT_FILENO;
+
+    size_t block_size = stream_block_size(jobs);
+    // Parallel runs wait for full blocks, except when monitoring
+    bool fill = jobs > 1 && !monitor;
+    uint8_t *buffer = map.data ? NULL : malloc(block_size);
+    // Worst case: every byte at full expansion, each preceded by a separator.
+    // A monitor encodes after the output it is holding back.
+    size_t held = monitor ? monitor->flush_bytes : 0;
+    uint8_t *encoded = malloc(held + block_size * (ENCODE_MAX_EXPANSION + 1) + ENCODE_SLACK);
+    if ((!map.data && !buffer) || !encoded) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+
+    size_t pos = 0;
+    size_t total = 0;
+    size_t pending = 0;       // Encoded bytes a monitor is holding back
+    size_t dropped = 0;       // and those it dropped
+    uint64_t deadline = 0;    // when the held bytes go out
+    for (;;) {
+        if (pending > 0 && !map.data) {
+            // Flush on time even if the input goes quiet
+            uint64_t now = monotonic_ms();
+            if (!input_ready(fd, now < deadline ? (int)(deadline - now) : 0)) {
+                dropped += monitor_flush(encoded, pending);
+                pending = 0;
+                continue;
+            }
+        }
+        const uint8_t *block = map.data ? map.data + pos : buffer;
+        size_t len;
+        if (map.data) {
+            len = map.size - pos < block_size ? map.size - pos : block_size;
+#if PB_SPLICE
+        } else if (pass == PASSTHROUGH_TEE) {
+            len = tee_block(fd, buffer, block_size, fill);
+#endif
+        } else {
+            len = read_block(fd, buffer, block_size, fill);
+        }
+        if (len == 0) {
+            break;
+        }
+        // Original data goes to stdout alongside the encoding
+        if (pass == PASSTHROUGH_COPY) {
+            write_all(STDOUT_FILENO, block, len);
+#if PB_SPLICE
+        } else if (pass == PASSTHROUGH_SPLICE) {
+            splice_block(fd, map.offset + pos, len);
+#endif
+        }
+        size_t written = jobs > 1
+            ? encode_parallel(block, len, pos, encoded + pending, format, jobs)
+            : encode_range(block, len, pos, encoded + pending, format);
+        if (monitor) {
+            if (pending == 0) {
+                deadline = monotonic_ms() + (uint64_t)monitor->flush_ms;
+            }
+            pending += written;
+            if (pending >= monitor->flush_bytes || monotonic_ms() >= deadline) {
+                dropped += monitor_flush(encoded, pending);
+                pending = 0;
+            }
+        } else {
+            write_all(out, encoded, written);
+        }
+        if (map.data) {
+            map_release(&map, pos, pos + len);
+        }
+        pos += len;
+        total += written;
+    }
+
+    if (pending > 0) {
+        dropped += monitor_flush(encoded, pending);
+    }
+    if (monitor) {
+        // The data is all through: end it for the consumer now, even if the
+        // messages below wait on a stalled stderr
+        close(STDOUT_FILENO);
+    }
+    map_close(&map);
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+    free(buffer);
+    free(encoded);
+    if (passthrough && total > dropped) {
+        // The totals are only known now, after the encoding has gone to
+        // stderr; end its line so the messages don't run on from it
+        fputc('\n', stderr);
+    }
+    if (monitor) {
+        fprintf(stderr, "Dropped %zu bytes of encoded output\n", dropped);
+    }
+    fprintf(stderr, "Encoded %zu bytes of input to %zu bytes\n", pos, total - separators_before(format, pos));
+}
+
+#if PB_IO_URING
+// encode_stream over io_uring. Returns false, having read nothing, when
+// io_uring can't be used for this input.
+static bool encode_stream_uring(const char *filename, const format_t *format, int jobs) {
+    int fd = open_input(filename);
+    size_t block_size = stream_block_size(jobs);
+    uring_t ring;
+    if (!uring_init(&ring, fd, block_size, block_size * (ENCODE_MAX_EXPANSION + 1) + ENCODE_SLACK)) {
+        if (fd != STDIN_FILENO) {
+            close(fd);
+        }
+        return false;
+    }
+
+    size_t pos = 0;
+    size_t total = 0;
+    size_t len;
+    const uint8_t *block;
+    while ((block = uring_next_input(&ring, &len)) != NULL) {
+        uint8_t *encoded = uring_output(&ring);
+        size_t written = jobs > 1
+            ? encode_parallel(block, len, pos, encoded, format, jobs)
+            : encode_range(block, len, pos, encoded, format);
+        uring_release_input(&ring);
+        uring_write(&ring, written);
+        pos += len;
+        total += written;
+    }
+
+    uring_finish(&ring);
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+    fprintf(stderr, "Encoded %zu bytes of input to %zu bytes\n", pos, total - separators_before(format, pos));
+    return true;
+}
+#endif
+
+// Exact size of the encoded (and, if requested, formatted) output of a file
+// or stdin, summed block by block
+static size_t encoded_size_stream(const char *filename, const format_t *format) {
+    int fd = open_input(filename);
+    mapped_input_t map = map_input(fd);
+    if (map.data) {
+        size_t total = 0;
+        for (size_t pos = 0; pos < map.size; pos += STREAM_BLOCK_SIZE) {
+            size_t len = map.size - pos < STREAM_BLOCK_SIZE ? map.size - pos : STREAM_BLOCK_SIZE;
+            total += kernel->encoded_size(map.data + pos, len);
+            map_release(&map, pos, pos + len);
+        }
+        map_close(&map);
+        if (fd != STDIN_FILENO) {
+            close(fd);
         }
+        return total + separators_before(format, map.size);
     }
 
-    buf->data = new_data;
-    buf->capacity = new_capacity;
+    uint8_t *block = malloc(STREAM_BLOCK_SIZE);
+    if (!block) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+
+    size_t pos = 0;
+    size_t total = 0;
+    size_t len;
+    while ((len = read_block(fd, block, STREAM_BLOCK_SIZE, false)) > 0) {
+        total += kernel->encoded_size(block, len);
+        pos += len;
+    }
+
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+    free(block);
+    return total + separators_before(format, pos);
 }
 
-// Append data to buffer with automatic growth
-static void buffer_append(buffer_t *buf, const void *data, size_t len) {
-    if (buf->size + len > buf->capacity) {
-        buffer_grow(buf, len);
+// First character boundary at or after pos. UTF-8 resynchronizes on any
+// byte that is neither a continuation nor whitespace: no character spans
+// such a byte, so input split there decodes the same piece by piece.
+static size_t decode_boundary(const uint8_t *input, size_t input_len, size_t pos) {
+    while (pos < input_len && ((input[pos] & 0xC0) == 0x80 || is_decode_whitespace(input[pos]))) {
+        pos++;
     }
+    return pos;
+}
 
-    memcpy(buf->data + buf->size, data, len);
-    buf->size += len;
+// First point at or after pos where input can be split for decoding: a
+// character boundary outside any annotation, whose text would otherwise
+// decode as characters. No annotation may be open at from (<= pos).
+static size_t decode_split(const uint8_t *input, size_t input_len, size_t from, size_t pos) {
+    pos = decode_boundary(input, input_len, pos);
+    if (open_annotation(input, from, pos) < pos) {
+        pos = line_end(input, input_len, pos);
+    }
+    return pos;
 }
 
-// Append a single character to buffer
-static void buffer_append_char(buffer_t *buf, char c) {
-    buffer_append(buf, &c, 1);
+// Check a decode for skipped input. A valid character is one lead plus the
+// continuation bytes of its output byte's encoding, so input decoded cleanly
+// exactly when there is one output byte per lead and the output re-encodes
+// to the input's lead and continuation bytes. Both checks are branch-free
+// passes (the second is the encode kernel's own sizing).
+static bool decode_matches_counts(decode_counts_t counts, const uint8_t *output, size_t output_len) {
+    return output_len == counts.leads &&
+           kernel->encoded_size(output, output_len) == counts.leads + counts.continuations;
 }
 
-// Prepare buffer for return - ensure data is heap-allocated
-static void buffer_prepare_return(buffer_t *buf) {
-    if (buf->uses_stack && buf->size > 0) {
-        // Need to transition from stack to heap before returning
-        char *heap_data = malloc(buf->size);
-        if (!heap_data) {
-            fprintf(stderr, "Memory allocation failed\n");
-            exit(1);
+// Decode printable UTF-8 back to binary; whitespace anywhere is ignored.
+// With valid non-NULL, each chunk is also checked while it is still in cache,
+// and *valid cleared if any input was skipped.
+// Annotations never reach the kernels: a chunk is decoded in runs up to
+// each one, which is skipped through to the end of its line.
+// Writes at most len bytes to out, returns bytes written.
+static size_t decode_range(const uint8_t *input, size_t input_len, uint8_t *out, bool *valid) {
+    uint8_t *start = out;
+    annotation_scan_t scan = {0, 0};
+    size_t pos = 0;
+    while (pos < input_len) {
+        size_t end = input_len - pos < DECODE_CHUNK_SIZE ? input_len : pos + DECODE_CHUNK_SIZE;
+        end = decode_boundary(input, input_len, end);
+        while (pos < end) {
+            size_t annotation = next_annotation(input, pos, end, &scan);
+            size_t written = kernel->decode(input + pos, annotation - pos, out);
+            if (valid && !decode_matches_counts(kernel->count_decode(input + pos, annotation - pos), out, written)) {
+                *valid = false;
+            }
+            out += written;
+            pos = annotation < end ? line_end(input, input_len, annotation) : end;
         }
-        memcpy(heap_data, buf->stack_data, buf->size);
-        buf->data = heap_data;
-        buf->capacity = buf->size;
-        buf->uses_stack = false;
     }
+    return out - start;
 }
 
-// Free buffer memory
-static void buffer_free(buffer_t *buf) {
-    if (buf->data && !buf->uses_stack) {
-        free(buf->data);
-    }
-    // Don't set data to NULL for stack buffers since it points to stack_data
-    if (!buf->uses_stack) {
-        buf->data = NULL;
+// Decode in place: the input is buf[DECODE_IN_PLACE_GAP, DECODE_IN_PLACE_GAP
+// + len) and its decoded bytes are written from buf[0], over it. Output can
+// never overtake input (each character is at least one byte), but vector
+// kernels store a whole vector ahead of their output. Starting the output a
+// vector behind the input keeps every store clear of input not yet read.
+// Returns bytes written.
+static size_t decode_in_place(uint8_t *buf, size_t len) {
+    return decode_range(buf + DECODE_IN_PLACE_GAP, len, buf, NULL);
+}
+
+// Decode into a region of exactly kernel->count_decode(input, len).leads bytes.
+// Vector kernels may store up to a vector past their output, so the input
+// holding the last ENCODE_SLACK counted bytes goes through a bounce buffer
+// and the stores of the first part stay inside the region.
+static size_t decode_bounded(const uint8_t *input, size_t len, uint8_t *out) {
+    uint8_t tail[2 * ENCODE_SLACK];
+    size_t head = len;
+    for (size_t counted = 0; head > 0 && counted < ENCODE_SLACK; ) {
+        head--;
+        counted += (input[head] & 0xC0) != 0x80 && !is_decode_whitespace(input[head]);
     }
-    buf->size = 0;
-    buf->capacity = 0;
+    head = decode_split(input, len, 0, head);
+    size_t written = decode_range(input, head, out, NULL);
+    size_t tail_len = decode_range(input + head, len - head, tail, NULL);
+    memcpy(out + written, tail, tail_len);
+    return written + tail_len;
 }
 
-// Helper function to create UTF-8 sequence
-static utf8_sequence_t make_utf8(const char *bytes) {
-    utf8_sequence_t seq = {0};
-    seq.length = strlen(bytes);
-    memcpy(seq.bytes, bytes, seq.length);
-    return seq;
+// One thread's share of a parallel decode: input[start, end)
+typedef struct {
+    const uint8_t *input;
+    size_t start;
+    size_t end;
+    decode_counts_t counts;
+    size_t offset;   // Output offset of this share
+    size_t size;     // Bytes written
+    bool validate;
+    bool valid;
+    uint8_t *output;
+} decode_job_t;
+
+static void *decode_job_count(void *arg) {
+    decode_job_t *job = arg;
+    job->counts = kernel->count_decode(job->input + job->start, job->end - job->start);
+    return NULL;
 }
 
-// Helper function to calculate hash for decode table
-static uint16_t utf8_hash(const uint8_t *bytes, uint8_t len) {
-    if (len == 1) {
-        return bytes[0];
-    } else if (len == 2) {
-        return (bytes[0] << 8) | bytes[1];
-    } else if (len == 3) {
-        // For 3-byte sequences, use a simple hash
-        return ((bytes[0] & 0x0F) << 12) | ((bytes[1] & 0x3F) << 6) | (bytes[2] & 0x3F);
-    }
-    return 0;
+static void *decode_job_write(void *arg) {
+    decode_job_t *job = arg;
+    uint8_t *out = job->output + job->offset;
+    job->size = decode_bounded(job->input + job->start, job->end - job->start, out);
+    job->valid = !job->validate || decode_matches_counts(job->counts, out, job->size);
+    return NULL;
 }
 
-// Initialize encoding and decoding tables
-static void init_tables(void) {
-    // Allocate memory for tables
-    encode_table = calloc(256, sizeof(utf8_sequence_t));
-    decode_table = calloc(DECODE_MAP_SIZE, sizeof(uint8_t));
-    decode_table_valid = calloc(DECODE_MAP_SIZE, sizeof(bool));
+// Decode on several threads. The input is cut into one share per thread at
+// resynchronized character boundaries; a counting pass gives each share's
+// decoded size, an exclusive prefix sum turns sizes into output offsets, and
+// the worker pool then decodes straight into one shared output buffer (the
+// pool encode_parallel uses, so a stream starts its threads once). Invalid
+// input decodes short of its count; those shares are closed up afterwards.
+// Writes at most len bytes to out, returns bytes written.
+static size_t decode_parallel(const uint8_t *input, size_t input_len, uint8_t *out, int thread_count, bool *valid) {
+    if (input_len < 2 * PARALLEL_CHUNK_SIZE) {
+        return decode_range(input, input_len, out, valid);
+    }
+    if ((size_t)thread_count > input_len / PARALLEL_CHUNK_SIZE) {
+        thread_count = (int)(input_len / PARALLEL_CHUNK_SIZE);
+    }
 
-    if (!encode_table || !decode_table || !decode_table_valid) {
-        fprintf(stderr, "Memory allocation failed for lookup tables\n");
+    decode_job_t *jobs = malloc(thread_count * sizeof(decode_job_t));
+    if (!jobs) {
+        fprintf(stderr, "Memory allocation failed\n");
         exit(1);
     }
+    size_t start = 0;
+    for (int t = 0; t < thread_count; t++) {
+        size_t end = input_len;
+        if (t < thread_count - 1) {
+            // A long annotation can carry a share past the next one's start
+            size_t nominal = input_len * (t + 1) / thread_count;
+            end = decode_split(input, input_len, start, nominal > start ? nominal : start);
+        }
+        jobs[t] = (decode_job_t){
+            .input = input,
+            .start = start,
+            .end = end,
+            .validate = valid != NULL,
+        };
+        start = end;
+    }
 
-    // Initialize decode table as invalid (already zeroed by calloc)
-
-    // Define special UTF-8 sequences for control characters
-    const char *special_sequences[256] = {0}; // Initialize all to NULL
-    special_sequences[0] = "\xe2\x88\x85";    // ∅ (U+2205)
-    special_sequences[1] = "\xc2\xaf";        // ¯ (U+00AF)
-    special_sequences[2] = "\xc2\xab";        // « (U+00AB)
-    special_sequences[3] = "\xc2\xbb";        // » (U+00BB)
-    special_sequences[4] = "\xcf\x9f";        // ϟ (U+03DF)
-    special_sequences[5] = "\xc2\xbf";        // ¿ (U+00BF)
-    special_sequences[6] = "\xc2\xa1";        // ¡ (U+00A1)
-    special_sequences[7] = "\xc2\xaa";        // ª (U+00AA)
-    special_sequences[8] = "\xe2\x8c\xab";    // ⌫ (U+232B)
-    special_sequences[9] = "\xe2\x87\xa5";    // ⇥ (U+21E5)
-    special_sequences[10] = "\xe2\x87\xa9";   // ⇩ (U+21E9)
-    special_sequences[11] = "\xe2\x8a\xa7";   // ↧ (U+21A7)
-    special_sequences[12] = "\xc2\xa7";       // § (U+00A7)
-    special_sequences[13] = "\xe2\x8f\x8e";   // ⏎ (U+23CE)
-    special_sequences[14] = "\xc8\xaf";       // ȯ (U+022F)
-    special_sequences[15] = "\xca\x98";       // ʘ (U+0298)
-    special_sequences[16] = "\xc6\x94";       // Ɣ (U+0194)
-    special_sequences[17] = "\xc2\xb9";       // ¹ (U+00B9)
-    special_sequences[18] = "\xc2\xb2";       // ² (U+00B2)
-    special_sequences[19] = "\xc2\xba";       // º (U+00BA)
-    special_sequences[20] = "\xc2\xb3";       // ³ (U+00B3)
-    special_sequences[21] = "\xc2\xb5";       // µ (U+00B5)
-    special_sequences[22] = "\xc9\xa8";       // ɨ (U+0268)
-    special_sequences[23] = "\xc2\xac";       // ¬ (U+00AC)
-    special_sequences[24] = "\xc2\xa9";       // © (U+00A9)
-    special_sequences[25] = "\xc2\xa6";       // ¦ (U+00A6)
-    special_sequences[26] = "\xc6\xb5";       // Ƶ (U+01B5)
-    special_sequences[27] = "\xe2\x8e\x8b";   // ⎋ (U+238B)
-    special_sequences[28] = "\xce\x9e";       // Ξ (U+039E)
-    special_sequences[29] = "\xc7\x81";       // ǁ (U+01C1)
-    special_sequences[30] = "\xc7\x80";       // ǀ (U+01C0)
-    special_sequences[31] = "\xc2\xb6";       // ¶ (U+00B6)
-    special_sequences[32] = "\xe2\x90\xa3";   // ␣ (U+2423)
-    special_sequences[33] = "\xef\xb9\x97";   // ﹗ (U+FE57) Small Exclamation Mark
-    special_sequences[34] = "\xcb\xb5";       // ˵ (U+02F5)
-    special_sequences[35] = "\xe2\x99\xaf";   // ♯ (U+266F) Music Sharp Sign
-    special_sequences[36] = "\xef\xb9\xa9";   // ﹩ (U+FE69) Small Dollar Sign
-    special_sequences[37] = "\xef\xb9\xaa";   // ﹪ (U+FE6A) Small Percent Sign
-    special_sequences[38] = "\xef\xb9\xa0";   // ﹠ (U+FE60) Small Ampersand
-    special_sequences[39] = "\xca\xbc";       // ʼ (U+02BC)
-    special_sequences[40] = "\xe2\x9d\xa8";   // ❨ (U+2768) Medium Left Parenthesis Ornament
-    special_sequences[41] = "\xe2\x9d\xa9";   // ❩ (U+2769) Medium Right Parenthesis Ornament
-    special_sequences[42] = "\xef\xb9\xa1";   // ﹡ (U+FE61) Small Asterisk
-    special_sequences[43] = "\xef\xb9\xa2";   // ﹢ (U+FE62) Small Plus Sign
-    special_sequences[45] = "\xef\xb9\xa3";   // ﹣ (U+FE63) Small Hyphen-Minus
-    special_sequences[47] = "\xe2\x81\x84";   // ⁄ (U+2044) Fraction Slash
-    special_sequences[58] = "\xef\xb9\x95";   // ﹕ (U+FE55) Small Colon
-    special_sequences[59] = "\xef\xb9\x94";   // ﹔ (U+FE54) Small Semicolon
-    special_sequences[61] = "\xef\xb9\xa6";   // ﹦ (U+FE66) Small Equals Sign
-    special_sequences[63] = "\xef\xb9\x96";   // ﹖ (U+FE56) Small Question Mark
-    special_sequences[64] = "\xef\xb9\xab";   // ﹫ (U+FE6B) Small Commercial At
-    special_sequences[91] = "\xe2\x9f\xa6";   // ⟦ (U+27E6) Mathematical Left White Square Bracket
-    special_sequences[92] = "\xe2\xa7\xb9";   // ⧹ (U+29F9) Big Reverse Solidus
-    special_sequences[93] = "\xe2\x9f\xa7";   // ⟧ (U+27E7) Mathematical Right White Square Bracket
-    special_sequences[96] = "\xcb\x8b";       // ˋ (U+02CB) Modifier Letter Grave Accent
-    special_sequences[123] = "\xe2\x9d\xb4";  // ❴ (U+2774) Medium Left Curly Bracket Ornament
-    special_sequences[124] = "\xe2\x88\xa3";  // ∣ (U+2223) Divides
-    special_sequences[125] = "\xe2\x9d\xb5";  // ❵ (U+2775) Medium Right Curly Bracket Ornament
-    special_sequences[126] = "\xcb\x9c";      // ˜ (U+02DC) Small Tilde
-    special_sequences[127] = "\xe2\x8c\xa6";  // ⌦ (U+2326)
-    special_sequences[152] = "\xc5\x8c";      // Ō (U+014C)
-    special_sequences[184] = "\xc5\x8f";      // ŏ (U+014F)
-
-    // Build encoding table
-    for (int i = 0; i < 256; i++) {
-        if (special_sequences[i]) {
-            encode_table[i] = make_utf8(special_sequences[i]);
-        } else if (i >= 33 && i <= 126 && !special_sequences[i]) {
-            // Regular ASCII characters
-            char temp[2] = {i, 0};
-            encode_table[i] = make_utf8(temp);
-        } else if (i >= 128 && i < 192 && i != 152 && i != 184) {
-            // Extended ASCII 128-191: encoded with 0xC3 + original byte
-            char temp[3] = {0xc3, i, 0};
-            encode_table[i] = make_utf8(temp);
-        } else if (i >= 192 && i != 184) {
-            // Extended ASCII 192-255: encoded with 0xC4 + (byte - 192 + 128)
-            char temp[3] = {0xc4, i - 192 + 128, 0};
-            encode_table[i] = make_utf8(temp);
-        }
-    }
-
-    // Build decode table
-    for (int i = 0; i < 256; i++) {
-        if (encode_table[i].length > 0) {
-            uint16_t hash = utf8_hash(encode_table[i].bytes, encode_table[i].length);
-            decode_table[hash] = i;
-            decode_table_valid[hash] = true;
-        }
-    }
-}
-
-// Get UTF-8 sequence length from first byte
-static uint8_t utf8_sequence_length(uint8_t first_byte) {
-    if (first_byte < 0x80) return 1;
-    if (first_byte < 0xE0) return 2;
-    if (first_byte < 0xF0) return 3;
-    return 4;
-}
-
-// Encode binary data to printable UTF-8
-static buffer_t encode_data(const uint8_t *input, size_t input_len) {
-    buffer_t output;
-    // Start with reasonable initial size, will grow as needed
-    buffer_init(&output, INITIAL_BUFFER_SIZE);
+    run_jobs(decode_job_count, jobs, sizeof(decode_job_t), thread_count);
+
+    // Exclusive prefix sum: share sizes become write offsets
+    size_t total = 0;
+    for (int t = 0; t < thread_count; t++) {
+        jobs[t].offset = total;
+        total += jobs[t].counts.leads;
+    }
+
+    for (int t = 0; t < thread_count; t++) {
+        jobs[t].output = out;
+    }
 
-    for (size_t i = 0; i < input_len; i++) {
-        utf8_sequence_t seq = encode_table[input[i]];
-        if (seq.length > 0) {
-            buffer_append(&output, seq.bytes, seq.length);
+    run_jobs(decode_job_write, jobs, sizeof(decode_job_t), thread_count);
+
+    // Skipped bytes leave gaps after short shares
+    size_t written = 0;
+    for (int t = 0; t < thread_count; t++) {
+        if (jobs[t].offset != written) {
+            memmove(out + written, out + jobs[t].offset, jobs[t].size);
+        }
+        written += jobs[t].size;
+        if (valid && !jobs[t].valid) {
+            *valid = false;
         }
     }
 
-    return output;
+    free(jobs);
+    return written;
 }
 
-// Decode printable UTF-8 back to binary
-static buffer_t decode_data(const uint8_t *input, size_t input_len) {
-    buffer_t output;
-    // Start with reasonable initial size, will grow as needed
-    buffer_init(&output, INITIAL_BUFFER_SIZE);
+// Print input[start, end) as hex, shortened past 16 bytes (only those are read)
+static void print_hex_bytes(const uint8_t *input, size_t start, size_t end) {
+    for (size_t i = start; i < end && i < start + 16; i++) {
+        fprintf(stderr, " %02x", input[i]);
+    }
+    if (end - start > 16) {
+        fprintf(stderr, " ...");
+    }
+    fprintf(stderr, "\n");
+}
 
+// Position of a streamed decode, and the run of skipped bytes being
+// collected, for --strict and --report-skipped messages. Offsets are 0-based,
+// lines and columns (in bytes) 1-based.
+typedef struct {
+    size_t offset;       // Stream offset of the next block
+    size_t line;         // Line at offset
+    size_t line_start;   // Stream offset where that line starts
+    size_t skipped;      // Bytes skipped so far
+    // Current run of skipped bytes: [run_start, run_end) and its first bytes
+    size_t run_start, run_end, run_line, run_column;
+    uint8_t run_bytes[16];
+} decode_report_t;
+
+// Print the run of skipped bytes collected so far, if any
+static void report_finish(decode_report_t *report) {
+    if (report->run_end == report->run_start) {
+        return;
+    }
+    fprintf(stderr, "Skipped offsets %zu-%zu (line %zu, column %zu):",
+            report->run_start, report->run_end - 1, report->run_line, report->run_column);
+    print_hex_bytes(report->run_bytes, 0, report->run_end - report->run_start);
+    report->run_start = report->run_end;
+}
+
+// Move the report past a block that decoded cleanly
+static void report_advance(decode_report_t *report, const uint8_t *block, size_t len) {
+    const uint8_t *end = block + len;
+    for (const uint8_t *p = block; (p = memchr(p, '\n', end - p)) != NULL; p++) {
+        report->line++;
+        report->line_start = report->offset + (p - block) + 1;
+    }
+    report->offset += len;
+}
+
+// Walk a block one character at a time, as the decode kernels do, and
+// report the bytes they skip: in strict mode the first invalid sequence,
+// then exit; otherwise every run of skipped bytes. Runs still open at the
+// end of the block are printed by the next block or report_finish.
+static void report_skipped(decode_report_t *report, const uint8_t *block, size_t len, bool strict) {
     size_t i = 0;
-    while (i < input_len) {
-        uint8_t first_byte = input[i];
-        uint8_t seq_len = utf8_sequence_length(first_byte);
-
-        // Ensure we don't go beyond input
-        if (i + seq_len > input_len) {
-            seq_len = input_len - i;
-        }
-
-        bool matched = false;
-
-        // Try from expected length down to 1
-        for (uint8_t len = seq_len; len >= 1 && len <= 3; len--) {
-            if (i + len <= input_len) {
-                uint16_t hash = utf8_hash(input + i, len);
-                if (decode_table_valid[hash]) {
-                    uint8_t decoded_byte = decode_table[hash];
-                    buffer_append_char(&output, decoded_byte);
-                    i += len;
-                    matched = true;
-                    break;
+    while (i < len) {
+        size_t next = i + 1;
+        bool invalid = false;
+        if (is_annotation_start(block, len, i)) {
+            next = line_end(block, len, i);
+        } else if (!is_decode_whitespace(block[i])) {
+            uint8_t byte;
+            uint8_t *out = &byte;
+            next = i + decode_char(block, len, i, &out);
+            invalid = out == &byte;
+        }
+
+        if (invalid) {
+            size_t offset = report->offset + i;
+            size_t column = offset - report->line_start + 1;
+            if (strict) {
+                // Show the offending character: its lead and continuation bytes
+                size_t end = i + 1;
+                while (end < len && (block[end] & 0xC0) == 0x80) {
+                    end++;
                 }
+                fprintf(stderr, "Error: invalid sequence at offset %zu (line %zu, column %zu):",
+                        offset, report->line, column);
+                print_hex_bytes(block, i, end);
+                exit(1);
+            }
+            if (offset != report->run_end || report->run_end == report->run_start) {
+                report_finish(report);
+                report->run_start = offset;
+                report->run_end = offset;
+                report->run_line = report->line;
+                report->run_column = column;
+            }
+            if (report->run_end - report->run_start < sizeof(report->run_bytes)) {
+                report->run_bytes[report->run_end - report->run_start] = block[i];
             }
+            report->run_end++;
+            report->skipped++;
         }
 
-        if (!matched) {
-            // Skip unrecognized byte
-            i++;
+        for (; i < next; i++) {
+            if (block[i] == '\n') {
+                report->line++;
+                report->line_start = report->offset + i + 1;
+            }
         }
     }
-
-    buffer_prepare_return(&output);
-    return output;
+    report->offset += len;
 }
 
-// Apply formatting to encoded output
-static buffer_t format_output(const buffer_t *input, int group_size, int groups_per_line) {
-    buffer_t output;
-    // Start with reasonable initial size, will grow as needed
-    buffer_init(&output, INITIAL_BUFFER_SIZE);
+// Length of the start of a streamed block that decodes the same whatever
+// input follows: all of it, unless its last lead byte has fewer than
+// ENCODE_MAX_EXPANSION - 1 continuation bytes after it (whitespace doesn't
+// count). That character may still be completed by the next read, so the
+// block is cut before its lead and the 0-2 byte remainder carried over.
+// Likewise an annotation not yet ended by a newline, or the start of a
+// receipt emoji, is carried over whole.
+static size_t decode_complete_prefix(const uint8_t *block, size_t len) {
+    size_t cut = len;
+    size_t continuations = 0;
+    for (size_t i = len; i > 0; i--) {
+        if ((block[i - 1] & 0xC0) == 0x80) {
+            if (++continuations == ENCODE_MAX_EXPANSION - 1) {
+                break;
+            }
+        } else if (!is_decode_whitespace(block[i - 1])) {
+            cut = i - 1;
+            break;
+        }
+    }
+    size_t partial = len < sizeof(decode_receipt) ? 0 : len - sizeof(decode_receipt) + 1;
+    for (; partial < cut; partial++) {
+        if (memcmp(block + partial, decode_receipt, len - partial) == 0) {
+            cut = partial;
+            break;
+        }
+    }
+    return open_annotation(block, 0, cut);
+}
 
-    size_t char_count = 0;
-    size_t i = 0;
+// Decode the complete characters input[0, cut) of a stream block into out,
+// which holds capacity bytes. Returns bytes written. If valid is non-NULL it
+// is cleared when input was skipped.
+static size_t decode_stream_block(const uint8_t *input, size_t cut, uint8_t *out, size_t capacity,
+                                  int jobs, bool *valid) {
+    if (cut + ENCODE_SLACK > capacity) {
+        // A long carry: kernels may write up to their input length, so
+        // decode into the counted leads. Past a block, a carry is only
+        // whitespace or annotation, so those fit.
+        decode_counts_t counts = kernel->count_decode(input, cut);
+        size_t written = decode_bounded(input, cut, out);
+        if (!decode_matches_counts(counts, out, written)) {
+            if (valid) {
+                *valid = false;
+            }
+        }
+        return written;
+    }
+    if (jobs > 1) {
+        return decode_parallel(input, cut, out, jobs, valid);
+    }
+    return decode_range(input, cut, out, valid);
+}
 
-    while (i < input->size) {
-        // Determine UTF-8 character length
-        uint8_t first_byte = (uint8_t)input->data[i];
-        uint8_t char_len = utf8_sequence_length(first_byte);
+// Decode a file or stdin block by block, writing each block's output as soon
+// as it is decoded, so memory stays bounded whatever the input size. With
+// strict or report, blocks are validated as they decode; a strict failure
+// exits before the failing block's output is written.
+//
+// Every character is at least as long as the byte it decodes to, so a plain
+// single-threaded decode writes its output over the block it is reading
+// (see decode_in_place) and needs no second buffer. Validating keeps the
+// input intact for reporting, and parallel shares would overwrite input
+// their neighbours are still reading, so those decode into a separate one.
+// That is allocated once and never grows: a block decodes to at most one
+// byte per lead, and holds at most one lead besides the bytes just read
+// (the carried character, whatever whitespace or annotation follows it).
+// Annotations count as leads, so a long one carried over can make the
+// counted leads overshoot; the output itself never does, and vector stores
+// run at most ENCODE_SLACK bytes past it.
+static void decode_stream(const char *filename, int jobs, bool strict, bool report) {
+    int fd = open_input(filename);
+
+    size_t block_size = stream_block_size(jobs);
+    // Decoding in place over the block just read beats decoding out of a
+    // read-only mapping into a second buffer; everything else that needs
+    // that buffer anyway decodes straight from the mapping
+    bool in_place = jobs <= 1 && !strict && !report;
+    mapped_input_t map = in_place ? (mapped_input_t){0} : map_input(fd);
+    // Input is read in after DECODE_IN_PLACE_GAP bytes, where in-place
+    // output starts
+    buffer_t block = {0}, decoded = {0};
+    if (!map.data) {
+        buffer_init(&block, DECODE_IN_PLACE_GAP + block_size + ENCODE_MAX_EXPANSION);
+        block.size = DECODE_IN_PLACE_GAP;
+    }
+    if (!in_place) {
+        buffer_init(&decoded, block_size + ENCODE_MAX_EXPANSION + ENCODE_SLACK);
+    }
 
-        // Append the UTF-8 character
-        for (uint8_t j = 0; j < char_len && i + j < input->size; j++) {
-            buffer_append_char(&output, input->data[i + j]);
+    decode_report_t position = {.line = 1};
+    size_t pos = 0;
+    size_t total = 0;
+    size_t carry = 0;
+    for (;;) {
+        const uint8_t *input;
+        size_t avail;
+        bool end;
+        if (map.data) {
+            // The carry stays where it is in the mapping; the block just
+            // starts at it
+            input = map.data + pos;
+            avail = map.size - pos < carry + block_size ? map.size - pos : carry + block_size;
+            end = pos + avail == map.size;
+        } else {
+            // The carry from the previous block is already in place; a lead
+            // followed by nothing but whitespace can make it longer than usual
+            buffer_reserve(&block, block_size);
+            size_t len = read_block(fd, (uint8_t *)block.data + block.size, block_size, jobs > 1);
+            block.size += len;
+            input = (uint8_t *)block.data + DECODE_IN_PLACE_GAP;
+            avail = block.size - DECODE_IN_PLACE_GAP;
+            end = len == 0;
+        }
+        size_t cut = end ? avail : decode_complete_prefix(input, avail);
+
+        if (cut > 0) {
+            size_t written;
+            uint8_t *out;
+            if (in_place) {
+                out = (uint8_t *)block.data;
+                written = decode_in_place(out, cut);
+            } else {
+                out = (uint8_t *)decoded.data;
+                bool valid = true;
+                bool *check = strict || report ? &valid : NULL;
+                written = decode_stream_block(input, cut, out, decoded.capacity, jobs, check);
+                if (!valid) {
+                    report_skipped(&position, input, cut, strict);
+                } else if (check) {
+                    report_advance(&position, input, cut);
+                }
+            }
+            write_all(STDOUT_FILENO, out, written);
+            if (map.data) {
+                map_release(&map, pos, pos + cut);
+            } else {
+                memmove(block.data + DECODE_IN_PLACE_GAP, input + cut, avail - cut);
+                block.size -= cut;
+            }
+            pos += cut;
+            total += written;
         }
+        carry = avail - cut;
+        if (end) {
+            break;
+        }
+    }
 
-        char_count++;
-        i += char_len;
+    map_close(&map);
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+    if (report) {
+        report_finish(&position);
+        fprintf(stderr, "Skipped %zu invalid bytes\n", position.skipped);
+    }
+    free(block.data);
+    free(decoded.data);
+    fprintf(stderr, "Decoded %zu bytes of input to %zu bytes\n", pos, total);
+}
 
-        // Add spacing after each group
-        if (char_count % group_size == 0 && i < input->size) {
-            if ((char_count / group_size) % groups_per_line == 0) {
-                buffer_append_char(&output, '\n');
-            } else {
-                buffer_append_char(&output, ' ');
+#if PB_IO_URING
+// decode_stream over io_uring. Each block's carry is copied into the room
+// in front of the next block, or, past URING_CARRY_ROOM, the next block is
+// appended to it. Returns false, having read nothing, when io_uring can't
+// be used for this input.
+static bool decode_stream_uring(const char *filename, int jobs, bool strict, bool report) {
+    int fd = open_input(filename);
+    size_t block_size = stream_block_size(jobs);
+    // Output never exceeds the input it decodes: a block and its carry
+    size_t capacity = URING_CARRY_ROOM + block_size + ENCODE_SLACK;
+    uring_t ring;
+    if (!uring_init(&ring, fd, block_size, capacity)) {
+        if (fd != STDIN_FILENO) {
+            close(fd);
+        }
+        return false;
+    }
+
+    decode_report_t position = {.line = 1};
+    buffer_t carry;
+    buffer_init(&carry, URING_CARRY_ROOM);
+    size_t pos = 0;
+    size_t total = 0;
+    for (;;) {
+        size_t len;
+        uint8_t *data = uring_next_input(&ring, &len);
+        bool end = data == NULL;
+        uint8_t *input;
+        size_t avail;
+        if (!end && carry.size <= URING_CARRY_ROOM) {
+            input = data - carry.size;
+            memcpy(input, carry.data, carry.size);
+            avail = carry.size + len;
+        } else {
+            if (!end) {
+                buffer_append(&carry, data, len);
+            }
+            input = (uint8_t *)carry.data;
+            avail = carry.size;
+        }
+        size_t cut = end ? avail : decode_complete_prefix(input, avail);
+
+        size_t written = 0;
+        if (cut > 0) {
+            uint8_t *out = uring_output(&ring);
+            bool valid = true;
+            bool *check = strict || report ? &valid : NULL;
+            written = decode_stream_block(input, cut, out, capacity, jobs, check);
+            if (!valid) {
+                if (strict) {
+                    // Everything before this block goes out before the exit
+                    uring_drain(&ring);
+                }
+                report_skipped(&position, input, cut, strict);
+            } else if (check) {
+                report_advance(&position, input, cut);
             }
         }
+        // Keep the carry before the block goes back to be read into
+        if (input == (uint8_t *)carry.data) {
+            memmove(carry.data, input + cut, avail - cut);
+            carry.size = avail - cut;
+        } else {
+            carry.size = 0;
+            buffer_append(&carry, input + cut, avail - cut);
+        }
+        if (!end) {
+            uring_release_input(&ring);
+        }
+        uring_write(&ring, written);
+        pos += cut;
+        total += written;
+        if (end) {
+            break;
+        }
     }
 
-    buffer_prepare_return(&output);
-    return output;
+    uring_finish(&ring);
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+    if (report) {
+        report_finish(&position);
+        fprintf(stderr, "Skipped %zu invalid bytes\n", position.skipped);
+    }
+    buffer_free(&carry);
+    fprintf(stderr, "Decoded %zu bytes of input to %zu bytes\n", pos, total);
+    return true;
 }
+#endif
 
-// Read entire file into memory
+// Read the whole input into memory, for the disassembly modes (--asm,
+// --smart-asm), which need all of it at once. Encoding and decoding stream
+// their input instead; see encode_stream and decode_stream.
 static buffer_t read_file(const char *filename) {
     buffer_t buf;
     size_t initial_capacity = INITIAL_BUFFER_SIZE;
@@ -413,18 +2770,7 @@ static buffer_t read_file(const char *filename) {
     char temp[8192];
     size_t bytes_read;
     while ((bytes_read = fread(temp, 1, sizeof(temp), file)) > 0) {
-        // If buffer too small, grow it
-        if (buf.size + bytes_read >= buf.capacity) {
-            buf.capacity = (buf.size + bytes_read) * 2;
-            buf.data = realloc(buf.data, buf.capacity);
-            if (!buf.data) {
-                fprintf(stderr, "Memory allocation failed\n");
-                exit(1);
-            }
-        }
-        // Manually append data (avoid buffer_append since it doesn't support realloc)
-        memcpy(buf.data + buf.size, temp, bytes_read);
-        buf.size += bytes_read;
+        buffer_append(&buf, temp, bytes_read);
     }
 
     if (file != stdin) {
@@ -435,36 +2781,33 @@ static buffer_t read_file(const char *filename) {
     return buf;
 }
 
-// Clean input for decoding (remove whitespace and disassembly formatting)
-static buffer_t clean_decode_input(const buffer_t *input) {
-    buffer_t output;
-    // Start with reasonable initial size, will grow as needed
-    buffer_init(&output, INITIAL_BUFFER_SIZE);
-
-    // Simple whitespace removal for now
-    for (size_t i = 0; i < input->size; i++) {
-        char c = input->data[i];
-        if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
-            buffer_append_char(&output, c);
-        }
-    }
-
-    buffer_prepare_return(&output);
-    return output;
-}
-
 static void print_usage(const char *program_name) {
     fprintf(stderr, "PrintableBinary C - Encode binary data as printable UTF-8 and decode it back\n\n");
     fprintf(stderr, "Usage: %s [options] [file]\n", program_name);
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "  -d, --decode     Decode mode (default is encode mode)\n");
+    fprintf(stderr, "  --strict         With -d: decode only valid input, stopping at the first invalid sequence\n");
+    fprintf(stderr, "  --report-skipped With -d: list every invalid range skipped while decoding\n");
     fprintf(stderr, "  -p, --passthrough  Pass input to stdout unchanged, send encoded data to stderr\n");
+    fprintf(stderr, "  --monitor[=BYTES[,MS]]  Passthrough for live streams: encoded data is sent once\n");
+    fprintf(stderr, "                    BYTES are pending or MS have passed (default 4096,50), and\n");
+    fprintf(stderr, "                    dropped (and counted) rather than waited for if stderr is full\n");
     fprintf(stderr, "  -f[=NxM], --format[=NxM]   Format output in groups\n");
     fprintf(stderr, "                    Default: 8x10 (groups of 8 chars, 10 groups per line)\n");
+    fprintf(stderr, "  -j N, --jobs=N   Encode or decode with N threads (0 = one per CPU)\n");
+    fprintf(stderr, "  --io-uring       Overlap reads and writes with io_uring (Linux, file input)\n");
+    fprintf(stderr, "                    Not with --passthrough, --monitor, --asm or --encoded-size;\n");
+    fprintf(stderr, "                    falls back to plain reads and writes for non-file input\n");
+    fprintf(stderr, "                    or where io_uring is unavailable\n");
     fprintf(stderr, "  -a, --asm        Raw disassembly (works on any data, uses cstool)\n");
     fprintf(stderr, "  --smart-asm      Smart disassembly (format-aware, uses objdump)\n");
     fprintf(stderr, "  --arch ARCH      Specify architecture for disassembly\n");
     fprintf(stderr, "                    Valid values: x64, x32, arm64, arm\n");
+    fprintf(stderr, "  --encoded-size   Print the exact size of the encoded output in bytes, then exit\n");
+    fprintf(stderr, "                    (includes -f separators when combined with -f)\n");
+    fprintf(stderr, "  --kernel=NAME    Use a specific encode/decode kernel instead of the best supported\n");
+    fprintf(stderr, "                    Valid values: avx512, avx2, sse41, scalar\n");
+    fprintf(stderr, "  --print-kernel   Show the selected and supported kernels, then exit\n");
     fprintf(stderr, "  -h, --help       Show this help\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "If no file is specified, input is read from stdin.\n");
@@ -481,6 +2824,7 @@ static void print_usage(const char *program_name) {
     fprintf(stderr, "  %s --smart-asm binary        # Smart disassembly (executables)\n", program_name);
     fprintf(stderr, "  %s -a --arch=arm64 binary    # Force ARM64 raw disassembly\n", program_name);
     fprintf(stderr, "  %s --passthrough file | tool # Monitor binary stream\n", program_name);
+    fprintf(stderr, "  producer | %s --monitor | consumer  # Watch a live stream\n", program_name);
 }
 
 // Parse command line options
@@ -492,9 +2836,19 @@ static options_t parse_options(int argc, char *argv[]) {
         .asm_mode = false,
         .smart_asm_mode = false,
         .help_mode = false,
+        .print_kernel = false,
+        .encoded_size_mode = false,
+        .strict_mode = false,
+        .report_mode = false,
+        .io_uring = false,
+        .monitor_mode = false,
+        .monitor_bytes = MONITOR_FLUSH_BYTES,
+        .monitor_ms = MONITOR_FLUSH_MS,
         .format_group = 8,
         .format_groups_per_line = 10,
+        .jobs = 1,
         .arch = NULL,
+        .kernel_name = NULL,
         .input_file = NULL
     };
 
@@ -505,12 +2859,20 @@ static options_t parse_options(int argc, char *argv[]) {
         {"asm", no_argument, 0, 'a'},
         {"smart-asm", no_argument, 0, 1001},
         {"arch", required_argument, 0, 1000},
+        {"kernel", required_argument, 0, 1002},
+        {"print-kernel", no_argument, 0, 1003},
+        {"encoded-size", no_argument, 0, 1004},
+        {"strict", no_argument, 0, 1005},
+        {"report-skipped", no_argument, 0, 1006},
+        {"io-uring", no_argument, 0, 1007},
+        {"monitor", optional_argument, 0, 1008},
+        {"jobs", required_argument, 0, 'j'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}
     };
 
     int c;
-    while ((c = getopt_long(argc, argv, "dpf::ah", long_options, NULL)) != -1) {
+    while ((c = getopt_long(argc, argv, "dpf::aj:h", long_options, NULL)) != -1) {
         switch (c) {
             case 'd':
                 opts.decode_mode = true;
@@ -527,7 +2889,7 @@ static options_t parse_options(int argc, char *argv[]) {
                         format_str++;
                     }
                     int group, groups_per_line;
-                    if (sscanf(format_str, "%dx%d", &group, &groups_per_line) == 2) {
+                    if (sscanf(format_str, "%dx%d", &group, &groups_per_line) == 2 && group > 0 && groups_per_line > 0) {
                         opts.format_group = group;
                         opts.format_groups_per_line = groups_per_line;
                     } else {
@@ -540,12 +2902,61 @@ static options_t parse_options(int argc, char *argv[]) {
             case 'a':
                 opts.asm_mode = true;
                 break;
+            case 'j': {
+                char *end;
+                long jobs = strtol(optarg, &end, 10);
+                if (*end != '\0' || jobs < 0 || jobs > 1024) {
+                    fprintf(stderr, "Invalid job count: %s\n", optarg);
+                    exit(1);
+                }
+                if (jobs == 0) {
+                    // 0 means one job per online CPU
+                    jobs = sysconf(_SC_NPROCESSORS_ONLN);
+                }
+                opts.jobs = jobs > 0 ? (int)jobs : 1;
+                break;
+            }
             case 1000: // --arch
                 opts.arch = optarg;
                 break;
             case 1001: // --smart-asm
                 opts.smart_asm_mode = true;
                 break;
+            case 1002: // --kernel
+                opts.kernel_name = optarg;
+                break;
+            case 1003: // --print-kernel
+                opts.print_kernel = true;
+                break;
+            case 1004: // --encoded-size
+                opts.encoded_size_mode = true;
+                break;
+            case 1005: // --strict
+                opts.strict_mode = true;
+                break;
+            case 1006: // --report-skipped
+                opts.report_mode = true;
+                break;
+            case 1007: // --io-uring
+                opts.io_uring = true;
+                break;
+            case 1008: // --monitor[=BYTES[,MS]]
+                opts.monitor_mode = true;
+                opts.passthrough_mode = true;
+                if (optarg) {
+                    size_t bytes;
+                    int ms = opts.monitor_ms;
+                    char extra;
+                    int fields = sscanf(optarg, "%zu,%d%c", &bytes, &ms, &extra);
+                    if ((fields != 1 && fields != 2) || bytes == 0 || ms < 0 || optarg[0] == '-') {
+                        fprintf(stderr, "Invalid monitor thresholds: %s\n", optarg);
+                        fprintf(stderr, "Expected bytes and milliseconds like: --monitor=4096,50\n");
+                        exit(1);
+                    }
+                    opts.monitor_bytes = bytes;
+                    opts.monitor_ms = ms;
+                }
+                break;
             case 'h':
                 opts.help_mode = true;
                 break;
@@ -565,8 +2976,9 @@ static options_t parse_options(int argc, char *argv[]) {
 }
 
 int main(int argc, char *argv[]) {
-    // Initialize encoding/decoding tables
-    init_tables();
+#ifdef DEBUG
+    check_tables();
+#endif
 
     // Parse command line options
     options_t opts = parse_options(argc, argv);
@@ -576,11 +2988,30 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
+    // Pick encode/decode kernels for this CPU
+    select_kernel(opts.kernel_name);
+
+    if (opts.print_kernel) {
+        print_kernels();
+        return 0;
+    }
+
     // Validate conflicting options
     if (opts.asm_mode && opts.smart_asm_mode) {
         fprintf(stderr, "Error: Cannot use both --asm and --smart-asm together\n");
         return 1;
     }
+    if ((opts.strict_mode || opts.report_mode) && !opts.decode_mode) {
+        fprintf(stderr, "Error: --strict and --report-skipped only apply when decoding (-d)\n");
+        return 1;
+    }
+    // These encode paths have no io_uring variant
+    if (opts.io_uring && !opts.decode_mode &&
+        (opts.passthrough_mode || opts.asm_mode || opts.smart_asm_mode || opts.encoded_size_mode)) {
+        fprintf(stderr, "Error: --io-uring cannot be combined with --passthrough, --monitor, "
+                        "--asm, --smart-asm or --encoded-size\n");
+        return 1;
+    }
 
     // Check for terminal input when no file specified
     if (!opts.input_file && isatty(STDIN_FILENO)) {
@@ -588,284 +3019,281 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
-    // Read input
-    buffer_t input = read_file(opts.input_file);
+    format_t format = {
+        .group_size = opts.format_mode ? (size_t)opts.format_group : 0,
+        .groups_per_line = (size_t)opts.format_groups_per_line
+    };
+
+    if (opts.encoded_size_mode) {
+        printf("%zu\n", encoded_size_stream(opts.input_file, &format));
+        return 0;
+    }
 
     if (opts.decode_mode) {
         if (opts.passthrough_mode) {
             fprintf(stderr, "Warning: --passthrough ignored in decode mode\n");
         }
+#if PB_IO_URING
+        if (opts.io_uring && decode_stream_uring(opts.input_file, opts.jobs, opts.strict_mode, opts.report_mode)) {
+            return 0;
+        }
+#endif
+        decode_stream(opts.input_file, opts.jobs, opts.strict_mode, opts.report_mode);
+        return 0;
+    }
 
-        fprintf(stderr, "Decoding mode: Input size is %zu bytes\n", input.size);
-
-        // Clean input and decode
-        buffer_t cleaned = clean_decode_input(&input);
-        fprintf(stderr, "After whitespace removal: %zu bytes\n", cleaned.size);
+    // Plain encoding streams in blocks; disassembly needs the whole input
+    // in memory
+    if (!opts.asm_mode && !opts.smart_asm_mode) {
+#if PB_IO_URING
+        if (opts.io_uring && encode_stream_uring(opts.input_file, &format, opts.jobs)) {
+            return 0;
+        }
+#endif
+        monitor_t monitor = {opts.monitor_bytes, opts.monitor_ms};
+        encode_stream(opts.input_file, &format, opts.jobs, opts.passthrough_mode,
+                      opts.monitor_mode ? &monitor : NULL);
+        return 0;
+    }
 
-        buffer_t decoded = decode_data((uint8_t*)cleaned.data, cleaned.size);
-        fprintf(stderr, "Decoded result size: %zu bytes\n", decoded.size);
+    // Read input
+    buffer_t input = read_file(opts.input_file);
 
-        // Write decoded data to stdout
-        fwrite(decoded.data, 1, decoded.size, stdout);
+    // Encode mode
+    if (opts.passthrough_mode) {
+        // Write original data to stdout
+        write_all(STDOUT_FILENO, input.data, input.size);
+    }
 
-        free(cleaned.data);
-        free(decoded.data);
-    } else {
-        // Encode mode
-        if (opts.passthrough_mode) {
-            // Write original data to stdout
-            fwrite(input.data, 1, input.size, stdout);
+    // Check for smart disassembly mode first
+    if (opts.smart_asm_mode) {
+        if (!opts.input_file) {
+            fprintf(stderr, "Error: Smart disassembly mode requires a file input\n");
+            exit(1);
         }
 
-        // Check for smart disassembly mode first
-        if (opts.smart_asm_mode) {
-            if (!opts.input_file) {
-                fprintf(stderr, "Error: Smart disassembly mode requires a file input\n");
-                exit(1);
-            }
-
-            // Check if objdump is available
-            if (system("which objdump > /dev/null 2>&1") != 0) {
-                fprintf(stderr, "Error: objdump not found. Smart disassembly requires objdump.\n");
-                exit(1);
-            }
+        // Check if objdump is available
+        if (system("which objdump > /dev/null 2>&1") != 0) {
+            fprintf(stderr, "Error: objdump not found. Smart disassembly requires objdump.\n");
+            exit(1);
+        }
 
-            fprintf(stderr, "# Smart disassembly using objdump (format-aware):\n");
+        fprintf(stderr, "# Smart disassembly using objdump (format-aware):\n");
 
-            // Create objdump command
-            char objdump_cmd[512];
-            snprintf(objdump_cmd, sizeof(objdump_cmd), "objdump -d \"%s\" 2>/dev/null", opts.input_file);
+        // Create objdump command
+        char objdump_cmd[512];
+        snprintf(objdump_cmd, sizeof(objdump_cmd), "objdump -d \"%s\" 2>/dev/null", opts.input_file);
 
-            FILE *objdump_pipe = popen(objdump_cmd, "r");
-            if (!objdump_pipe) {
-                fprintf(stderr, "Error: Failed to run objdump\n");
-                exit(1);
-            }
+        FILE *objdump_pipe = popen(objdump_cmd, "r");
+        if (!objdump_pipe) {
+            fprintf(stderr, "Error: Failed to run objdump\n");
+            exit(1);
+        }
 
-            buffer_t objdump_output;
-            buffer_init(&objdump_output, 0);  // Use default, will start with stack
+        buffer_t objdump_output;
+        buffer_init(&objdump_output, 0);  // Use default, will start with stack
 
-            char line[1024];
-            while (fgets(line, sizeof(line), objdump_pipe)) {
-                // Look for disassembly lines (address: bytes instruction)
-                unsigned int addr;
+        char line[1024];
+        while (fgets(line, sizeof(line), objdump_pipe)) {
+            // Look for disassembly lines (address: bytes instruction)
+            unsigned int addr;
 
-                char *colon_pos = strchr(line, ':');
+            char *colon_pos = strchr(line, ':');
 
-                if (colon_pos && sscanf(line, " %x:", &addr) == 1) {
-                    // Parse the rest after the colon
-                    char *rest = colon_pos + 1;
+            if (colon_pos && sscanf(line, " %x:", &addr) == 1) {
+                // Parse the rest after the colon
+                char *rest = colon_pos + 1;
 
-                    // Skip whitespace
-                    while (*rest && isspace(*rest)) rest++;
+                // Skip whitespace
+                while (*rest && isspace(*rest)) rest++;
 
-                    // Find where instruction starts (after hex bytes)
-                    char *instr_start = rest;
-                    int byte_count = 0;
-                    char clean_bytes[64] = {0};
+                // Find where instruction starts (after hex bytes)
+                char *instr_start = rest;
+                int byte_count = 0;
+                char clean_bytes[64] = {0};
 
-                    // Extract hex bytes
-                    while (*instr_start && byte_count < 32) {
-                        if (isxdigit(*instr_start)) {
-                            if (byte_count < 63) {
-                                clean_bytes[byte_count] = *instr_start;
-                                byte_count++;
-                            }
-                            instr_start++;
-                        } else if (*instr_start == ' ' || *instr_start == '\t') {
-                            // Skip whitespace, but if we hit a lot of spaces, we've reached the instruction
-                            int space_count = 0;
-                            char *temp = instr_start;
-                            while (*temp && (*temp == ' ' || *temp == '\t')) {
-                                space_count++;
-                                temp++;
-                            }
-                            if (space_count > 4) {
-                                instr_start = temp;
-                                break;
-                            }
-                            instr_start++;
-                        } else {
+                // Extract hex bytes
+                while (*instr_start && byte_count < 32) {
+                    if (isxdigit(*instr_start)) {
+                        if (byte_count < 63) {
+                            clean_bytes[byte_count] = *instr_start;
+                            byte_count++;
+                        }
+                        instr_start++;
+                    } else if (*instr_start == ' ' || *instr_start == '\t') {
+                        // Skip whitespace, but if we hit a lot of spaces, we've reached the instruction
+                        int space_count = 0;
+                        char *temp = instr_start;
+                        while (*temp && (*temp == ' ' || *temp == '\t')) {
+                            space_count++;
+                            temp++;
+                        }
+                        if (space_count > 4) {
+                            instr_start = temp;
                             break;
                         }
+                        instr_start++;
+                    } else {
+                        break;
                     }
+                }
 
-                    // Get instruction text
-                    char *instr_end = strchr(instr_start, '\n');
-                    if (instr_end) *instr_end = '\0';
+                // Get instruction text
+                char *instr_end = strchr(instr_start, '\n');
+                if (instr_end) *instr_end = '\0';
 
-                    // Remove leading/trailing whitespace from instruction
-                    while (*instr_start && isspace(*instr_start)) instr_start++;
-                    char *instr_tail = instr_start + strlen(instr_start) - 1;
-                    while (instr_tail > instr_start && isspace(*instr_tail)) {
-                        *instr_tail = '\0';
-                        instr_tail--;
-                    }
+                // Remove leading/trailing whitespace from instruction
+                while (*instr_start && isspace(*instr_start)) instr_start++;
+                char *instr_tail = instr_start + strlen(instr_start) - 1;
+                while (instr_tail > instr_start && isspace(*instr_tail)) {
+                    *instr_tail = '\0';
+                    instr_tail--;
+                }
 
-                    if (byte_count > 0 && strlen(instr_start) > 0) {
-                        // Convert hex bytes to encoded characters
-                        for (int i = 0; i < byte_count; i += 2) {
-                            if (i + 1 < byte_count) {
-                                char byte_str[3] = {clean_bytes[i], clean_bytes[i+1], '\0'};
-                                unsigned int byte_val;
-                                if (sscanf(byte_str, "%x", &byte_val) == 1) {
-                                    utf8_sequence_t seq = encode_table[byte_val];
-                                    buffer_append(&objdump_output, seq.bytes, seq.length);
-                                }
+                if (byte_count > 0 && strlen(instr_start) > 0) {
+                    // Convert hex bytes to encoded characters
+                    for (int i = 0; i < byte_count; i += 2) {
+                        if (i + 1 < byte_count) {
+                            char byte_str[3] = {clean_bytes[i], clean_bytes[i+1], '\0'};
+                            unsigned int byte_val;
+                            if (sscanf(byte_str, "%x", &byte_val) == 1) {
+                                utf8_sequence_t seq = encode_table[byte_val];
+                                buffer_append(&objdump_output, seq.bytes, seq.length);
                             }
                         }
-
-                        // Add receipt emoji and instruction
-                        buffer_append(&objdump_output, " 🧾 ", 6);
-                        buffer_append(&objdump_output, instr_start, strlen(instr_start));
-                        buffer_append(&objdump_output, "\n", 1);
                     }
-                } else if (strstr(line, "Disassembly of section") || strstr(line, "file format")) {
-                    // Include section headers as comments
-                    buffer_append(&objdump_output, "# ", 2);
-                    char *line_end = strchr(line, '\n');
-                    if (line_end) *line_end = '\0';
-                    // Trim whitespace
-                    char *trimmed = line;
-                    while (*trimmed && isspace(*trimmed)) trimmed++;
-                    char *tail = trimmed + strlen(trimmed) - 1;
-                    while (tail > trimmed && isspace(*tail)) {
-                        *tail = '\0';
-                        tail--;
-                    }
-                    buffer_append(&objdump_output, trimmed, strlen(trimmed));
+
+                    // Add receipt emoji and instruction
+                    buffer_append(&objdump_output, " 🧾 ", 6);
+                    buffer_append(&objdump_output, instr_start, strlen(instr_start));
                     buffer_append(&objdump_output, "\n", 1);
                 }
+            } else if (strstr(line, "Disassembly of section") || strstr(line, "file format")) {
+                // Include section headers as comments
+                buffer_append(&objdump_output, "# ", 2);
+                char *line_end = strchr(line, '\n');
+                if (line_end) *line_end = '\0';
+                // Trim whitespace
+                char *trimmed = line;
+                while (*trimmed && isspace(*trimmed)) trimmed++;
+                char *tail = trimmed + strlen(trimmed) - 1;
+                while (tail > trimmed && isspace(*tail)) {
+                    *tail = '\0';
+                    tail--;
+                }
+                buffer_append(&objdump_output, trimmed, strlen(trimmed));
+                buffer_append(&objdump_output, "\n", 1);
             }
-            pclose(objdump_pipe);
+        }
+        pclose(objdump_pipe);
 
-            // Output the smart disassembly
-            if (opts.passthrough_mode) {
-                fprintf(stderr, "%.*s", (int)objdump_output.size, objdump_output.data);
-            } else {
-                printf("%.*s", (int)objdump_output.size, objdump_output.data);
-            }
+        // Output the smart disassembly
+        write_all(opts.passthrough_mode ? STDERR_FILENO : STDOUT_FILENO,
+                  objdump_output.data, objdump_output.size);
 
-            buffer_free(&objdump_output);
-            return 0;
+        buffer_free(&objdump_output);
+        return 0;
 
-        } else if (opts.asm_mode) {
-            // Basic disassembly implementation
-            if (!opts.input_file) {
-                fprintf(stderr, "Error: Disassembly mode requires a file input\n");
+    } else if (opts.asm_mode) {
+        // Basic disassembly implementation
+        if (!opts.input_file) {
+            fprintf(stderr, "Error: Disassembly mode requires a file input\n");
+            exit(1);
+        }
+
+        // Check if cstool is available
+        if (system("which cstool > /dev/null 2>&1") != 0) {
+            fprintf(stderr, "Warning: Capstone disassembly engine not found. Install it for disassembly.\n");
+            fprintf(stderr, "Continuing with simple output...\n");
+        } else {
+            // Create hex dump command
+            char hex_cmd[512];
+            snprintf(hex_cmd, sizeof(hex_cmd), "xxd -p \"%s\" | tr -d '\\n'", opts.input_file);
+
+            FILE *hex_pipe = popen(hex_cmd, "r");
+            if (!hex_pipe) {
+                fprintf(stderr, "Error: Failed to create hex dump\n");
                 exit(1);
             }
 
-            // Check if cstool is available
-            if (system("which cstool > /dev/null 2>&1") != 0) {
-                fprintf(stderr, "Warning: Capstone disassembly engine not found. Install it for disassembly.\n");
-                fprintf(stderr, "Continuing with simple output...\n");
+            // Read hex data
+            char hex_data[65536]; // 64KB max for now
+            size_t hex_len = fread(hex_data, 1, sizeof(hex_data) - 1, hex_pipe);
+            hex_data[hex_len] = '\0';
+            pclose(hex_pipe);
+
+            // Determine architecture
+            const char *arch;
+            if (opts.arch) {
+                arch = opts.arch;
+                fprintf(stderr, "# Using specified architecture: %s\n", arch);
             } else {
-                // Create hex dump command
-                char hex_cmd[512];
-                snprintf(hex_cmd, sizeof(hex_cmd), "xxd -p \"%s\" | tr -d '\\n'", opts.input_file);
-
-                FILE *hex_pipe = popen(hex_cmd, "r");
-                if (!hex_pipe) {
-                    fprintf(stderr, "Error: Failed to create hex dump\n");
-                    exit(1);
-                }
+                // Simple auto-detection - default to x64
+                arch = "x64";
+                fprintf(stderr, "# Auto-detecting architecture...\n");
+                fprintf(stderr, "# Auto-detected architecture: x64\n");
+            }
+            fprintf(stderr, "# Disassembly using %s architecture:\n", arch);
 
-                // Read hex data
-                char hex_data[65536]; // 64KB max for now
-                size_t hex_len = fread(hex_data, 1, sizeof(hex_data) - 1, hex_pipe);
-                hex_data[hex_len] = '\0';
-                pclose(hex_pipe);
-
-                // Determine architecture
-                const char *arch;
-                if (opts.arch) {
-                    arch = opts.arch;
-                    fprintf(stderr, "# Using specified architecture: %s\n", arch);
-                } else {
-                    // Simple auto-detection - default to x64
-                    arch = "x64";
-                    fprintf(stderr, "# Auto-detecting architecture...\n");
-                    fprintf(stderr, "# Auto-detected architecture: x64\n");
-                }
-                fprintf(stderr, "# Disassembly using %s architecture:\n", arch);
+            // Create cstool command
+            char cstool_cmd[1024];
+            snprintf(cstool_cmd, sizeof(cstool_cmd), "echo '%s' | xargs cstool %s 2>/dev/null", hex_data, arch);
 
-                // Create cstool command
-                char cstool_cmd[1024];
-                snprintf(cstool_cmd, sizeof(cstool_cmd), "echo '%s' | xargs cstool %s 2>/dev/null", hex_data, arch);
+            FILE *cstool_pipe = popen(cstool_cmd, "r");
+            if (!cstool_pipe) {
+                fprintf(stderr, "Error: Failed to run cstool\n");
+                exit(1);
+            }
 
-                FILE *cstool_pipe = popen(cstool_cmd, "r");
-                if (!cstool_pipe) {
-                    fprintf(stderr, "Error: Failed to run cstool\n");
-                    exit(1);
-                }
+            // Read and parse disassembly output
+            char line[256];
+            buffer_t disasm_output;
+            buffer_init(&disasm_output, 0); // Will grow as needed, start with stack
 
-                // Read and parse disassembly output
-                char line[256];
-                buffer_t disasm_output;
-                buffer_init(&disasm_output, 0); // Will grow as needed, start with stack
-
-                while (fgets(line, sizeof(line), cstool_pipe)) {
-                    // Parse cstool format: " addr  bytes    instruction"
-                    unsigned int addr;
-                    char bytes[32], instruction[128];
-                    if (sscanf(line, " %x %31s %127[^\n]", &addr, bytes, instruction) == 3) {
-                        // Convert hex bytes to encoded characters
-                        for (size_t i = 0; i < strlen(bytes); i += 2) {
-                            char byte_str[3] = {bytes[i], bytes[i+1], '\0'};
-                            unsigned int byte_val;
-                            if (sscanf(byte_str, "%x", &byte_val) == 1) {
-                                utf8_sequence_t seq = encode_table[byte_val];
-                                if (seq.length > 0) {
-                                    buffer_append(&disasm_output, seq.bytes, seq.length);
-                                }
+            while (fgets(line, sizeof(line), cstool_pipe)) {
+                // Parse cstool format: " addr  bytes    instruction"
+                unsigned int addr;
+                char bytes[32], instruction[128];
+                if (sscanf(line, " %x %31s %127[^\n]", &addr, bytes, instruction) == 3) {
+                    // Convert hex bytes to encoded characters
+                    for (size_t i = 0; i < strlen(bytes); i += 2) {
+                        char byte_str[3] = {bytes[i], bytes[i+1], '\0'};
+                        unsigned int byte_val;
+                        if (sscanf(byte_str, "%x", &byte_val) == 1) {
+                            utf8_sequence_t seq = encode_table[byte_val];
+                            if (seq.length > 0) {
+                                buffer_append(&disasm_output, seq.bytes, seq.length);
                             }
                         }
-
-                        // Add disassembly separator and instruction
-                        const char *separator = " 🧾 ";
-                        buffer_append(&disasm_output, separator, strlen(separator));
-                        buffer_append(&disasm_output, instruction, strlen(instruction));
-                        buffer_append(&disasm_output, "\n", 1);
                     }
-                }
-                pclose(cstool_pipe);
 
-                // Output the disassembly
-                fwrite(disasm_output.data, 1, disasm_output.size, stdout);
-                free(disasm_output.data);
-                free(input.data);
-                return 0;
+                    // Add disassembly separator and instruction
+                    const char *separator = " 🧾 ";
+                    buffer_append(&disasm_output, separator, strlen(separator));
+                    buffer_append(&disasm_output, instruction, strlen(instruction));
+                    buffer_append(&disasm_output, "\n", 1);
+                }
             }
-        }
-
-        // Encode the data
-        buffer_t encoded = encode_data((uint8_t*)input.data, input.size);
-        fprintf(stderr, "Encoded %zu bytes of input to %zu bytes\n", input.size, encoded.size);
-
-        buffer_t *output = &encoded;
-        buffer_t formatted;
+            pclose(cstool_pipe);
 
-        // Apply formatting if requested
-        if (opts.format_mode) {
-            formatted = format_output(&encoded, opts.format_group, opts.format_groups_per_line);
-            output = &formatted;
+            // Output the disassembly
+            write_all(STDOUT_FILENO, disasm_output.data, disasm_output.size);
+            free(disasm_output.data);
+            free(input.data);
+            return 0;
         }
+    }
 
-        // Write encoded output
-        if (opts.passthrough_mode) {
-            // Send encoded data to stderr
-            fwrite(output->data, 1, output->size, stderr);
-        } else {
-            // Send encoded data to stdout
-            fwrite(output->data, 1, output->size, stdout);
-        }
+    // Disassembly unavailable: fall back to plain encoding
+    buffer_t encoded = encode_data((uint8_t*)input.data, input.size, &format);
+    fprintf(stderr, "Encoded %zu bytes of input to %zu bytes\n", input.size,
+            encoded.size - separators_before(&format, input.size));
 
-        free(encoded.data);
-        if (opts.format_mode) {
-            free(formatted.data);
-        }
-    }
+    // Write encoded output
+    // Encoded data goes to stderr in passthrough mode
+    write_all(opts.passthrough_mode ? STDERR_FILENO : STDOUT_FILENO, encoded.data, encoded.size);
+
+    free(encoded.data);
 
     free(input.data);
     return 0;